@@ -0,0 +1,100 @@
+/*
+ * Benchmark of the DS18B20 driver (user space)
+ *
+ * Reads every /dev/myDevice/device_DS18B20_<MINOR> in turn (binary format)
+ * and reports samples per second, p50/p99 latency of a read and CPU time.
+ *
+ * ds18b20_bench [reads]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../ds18b20.h"
+
+#define NODES "/dev/myDevice/device_DS18B20_*"
+
+static double now(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static double cpu(void) {
+    struct rusage r;
+
+    getrusage(RUSAGE_SELF, &r);
+    return r.ru_utime.tv_sec + r.ru_utime.tv_usec / 1e6 + r.ru_stime.tv_sec + r.ru_stime.tv_usec / 1e6;
+}
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    int reads = argc > 1 ? atoi(argv[1]) : 64;
+    int format = DS18B20_FORMAT_BINARY;
+    struct ds18b20_sample sample;
+    double *latency;
+    double start, cpuStart, t, wall, cpuTime;
+    int *fd;
+    glob_t nodes;
+    int i, n = 0, errors = 0;
+    size_t k;
+
+    if (reads < 1 || glob(NODES, 0, NULL, &nodes) != 0) {
+        fprintf(stderr, "usage : %s [reads], with the driver loaded\n", argv[0]);
+        return 1;
+    }
+
+    fd = calloc(nodes.gl_pathc, sizeof(int));
+    latency = calloc(reads, sizeof(double));
+    if (!fd || !latency)
+        return 1;
+
+    for (k = 0; k < nodes.gl_pathc; k++) {
+        fd[k] = open(nodes.gl_pathv[k], O_RDONLY);
+        if (fd[k] < 0 || ioctl(fd[k], DS18B20_IOC_SET_FORMAT, &format) < 0) {
+            perror(nodes.gl_pathv[k]);
+            return 1;
+        }
+    }
+
+    start = now();
+    cpuStart = cpu();
+
+    for (i = 0; i < reads; i++) {
+        t = now();
+        if (read(fd[i % nodes.gl_pathc], &sample, sizeof(sample)) == sizeof(sample))
+            latency[n++] = now() - t;
+        else
+            errors++;
+    }
+
+    wall = now() - start;
+    cpuTime = cpu() - cpuStart;
+
+    qsort(latency, n, sizeof(double), compare);
+
+    printf("%zu sensors, %i reads : %.2f samples/s, p50 %.3f ms, p99 %.3f ms, cpu %.3f ms/sample, %i errors\n",
+        nodes.gl_pathc, reads, n / wall,
+        n ? latency[n / 2] * 1e3 : 0, n ? latency[(n * 99) / 100 < n ? (n * 99) / 100 : n - 1] * 1e3 : 0,
+        cpuTime * 1e3 / (n ? n : 1), errors);
+
+    for (k = 0; k < nodes.gl_pathc; k++)
+        close(fd[k]);
+    globfree(&nodes);
+
+    return 0;
+}
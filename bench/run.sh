@@ -0,0 +1,56 @@
+#!/bin/sh
+# Benchmark scenarios of the DS18B20 driver (as root, from the directory of driver.ko)
+#
+# Simulated bus : SENSORS x RESOLUTIONS x ERRORS
+# Real bus : GPIO=<INT_GPIO> sh bench/run.sh, each resolution with the sensors of the bus
+#   (the resolution of the sensors is changed : they keep the last one of RESOLUTIONS
+#   until their next power on, the EEPROM is not written)
+#
+# ERRORS : <CRC errors %>:<bit errors per million> (a scratchpad is 72 bits)
+
+SENSORS=${SENSORS:-"1 8 32 64"}
+RESOLUTIONS=${RESOLUTIONS:-"9 10 11 12"}
+ERRORS=${ERRORS:-"0:0 1:140 2:281 5:712"}
+READS=${READS:-64}
+
+BENCH=bench/ds18b20_bench
+MODULE=./driver.ko
+
+run() {
+    # $1 : scenario, then the module parameters
+    name=$1
+    shift
+    # the log of the host is kept : only the lines after this marker are read
+    marker="ds18b20 bench $$ $(date +%s%N)"
+    echo "$marker" > /dev/kmsg
+    start=$(date +%s%N)
+    if ! insmod $MODULE my_bench=1 "$@"; then
+        echo "$name : insmod failed"
+        return
+    fi
+    end=$(date +%s%N)
+    echo "$name : load (search) $(( (end - start) / 1000000 )) ms"
+    dmesg | sed -n "/$marker/,\$p" | grep "mydevice : bench" | sed 's/.*mydevice : /    /'
+    echo "    $($BENCH $READS)"
+    rmmod driver
+}
+
+for n in $SENSORS; do
+    for r in $RESOLUTIONS; do
+        for e in $ERRORS; do
+            run "sim sensors=$n resolution=$r crc_errors=${e%%:*}%" \
+                my_backend=sim my_sim_sensors=$n my_sim_resolution=$r my_sim_error=${e##*:}
+        done
+    done
+done
+
+if [ -n "$GPIO" ]; then
+    for r in $RESOLUTIONS; do
+        insmod $MODULE my_gpio=$GPIO || exit 1
+        for node in /dev/myDevice/device_DS18B20_*; do
+            echo $r > $node
+        done
+        rmmod driver
+        run "gpio $GPIO resolution=$r" my_gpio=$GPIO
+    done
+fi
@@ -14,9 +14,18 @@ Prenom : Vincent
  * make
  * sudo insmod driver.ko my_gpio=<INT_GPIO> 
  * 
+ * Several buses (one GPIO for each bus) :
+ * sudo insmod driver.ko my_gpio=<INT_GPIO>,<INT_GPIO>,...
+ * 
  * Read temperature :
  * cat /dev/myDevice/device_DS18B20_<MINOR>
  * 
+ * Read every sensor with one broadcast conversion (Skip ROM 0xCC + 0x44) :
+ * sudo insmod driver.ko my_gpio=<INT_GPIO> my_broadcast=1
+ * 
+ * Read every sensor in one read (one conversion window for all the buses) :
+ * cat /dev/myDevice/all
+ * 
  * Change resolution (9 to 12) :
  * sudo echo '[9-12]' > /dev/myDevice/device_DS18B20_<MINOR>
  * 
@@ -39,9 +48,28 @@ Prenom : Vincent
 
 #include <linux/list.h>
 
+#include <linux/kthread.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+
+#include "ds18b20.h"
 
-/* Table for CRC-7 (polynomial x^7 + x^3 + 1) */
-const u8 crc7_syndrome_table[256] = {
+#define CREATE_TRACE_POINTS
+#include "ds18b20_trace.h"
+
+
+/* Table for the Dallas CRC-8 (polynomial x^8 + x^5 + x^4 + 1), ROM and scratchpad */
+static const u8 crc8_table[256] = {
 	0, 94, 188, 226, 97, 63, 221, 131, 194, 156, 126, 32, 163, 253, 31, 65,
 	157, 195, 33, 127, 252, 162, 64, 30, 95, 1, 227, 189, 62, 96, 130, 220,
 	35, 125, 159, 193, 66, 28, 254, 160, 225, 191, 93, 3, 128, 222, 60, 98,
@@ -63,45 +91,238 @@ const u8 crc7_syndrome_table[256] = {
 
 #define MY_DEVICE      "mydevice"
 #define GPIO_NUMBER     4 // By default, bus wire in rpi
+#define MAX_BUS         8 // Max number of buses (GPIO)
+#define MAX_DEVICE      128 // Minors reserved for the sensors of all buses (hotplug)
+#define ALL_MINOR       MAX_DEVICE // Minor of /dev/myDevice/all (every sensor in one read)
+#define ALL_LINE        48 // Max length of a line of /dev/myDevice/all
+
+// gpio define, one bus for each gpio
+int my_gpio[MAX_BUS] = { GPIO_NUMBER };
+int nbBus = 1;
+module_param_array(my_gpio,int,&nbBus,S_IRUGO);
+
+// number of samples kept for each sensor (history read with DS18B20_FORMAT_STREAM)
+int my_buffer = 256;
+module_param(my_buffer,int,S_IRUGO);
+
+// broadcast conversion (Skip ROM) : a read converts and reads every sensor of the bus
+int my_broadcast = 0;
+module_param(my_broadcast,int,S_IRUGO);
+
+// alarm sweep : after the broadcast conversion, only the sensors found by the Alarm Search (0xEC)
+// are read (temperature >= TH or <= TL, set with DS18B20_IOC_SET_ALARM), the others keep their last sample
+int my_alarm = 0;
+module_param(my_alarm,int,S_IRUGO);
+
+// fast read : only the 2 temperature bytes of the scratchpad (16 bits instead of 72),
+// checked against the last sample instead of the CRC
+int my_fast_read = 0;
+module_param(my_fast_read,int,S_IRUGO);
+
+// backend of the buses : "gpio" (1-Wire on my_gpio) or "sim" (simulated sensors, no GPIO)
+static char *my_backend = "gpio";
+module_param(my_backend,charp,S_IRUGO);
+
+// simulated backend : number of sensors on each bus, read bit errors (per million)
+int my_sim_sensors = 4;
+module_param(my_sim_sensors,int,S_IRUGO);
+int my_sim_error = 0;
+module_param(my_sim_error,int,S_IRUGO);
+// simulated backend : resolution of the sensors at power on (9 to 12)
+int my_sim_resolution = 12;
+module_param(my_sim_resolution,int,S_IRUGO);
+
+// benchmark of the 1-Wire transactions of each bus at init (printed in the kernel log)
+int my_bench = 0;
+module_param(my_bench,int,S_IRUGO);
+
+// sampling interval (ms) of the background thread, 0 = read the bus on each read
+int my_interval = 0;
+module_param(my_interval,int,S_IRUGO);
+
+// rescan interval (ms) of the buses by the background thread (needs my_interval), 0 = only with /sys/class/myDevice/bus<N>/rescan
+int my_rescan = 0;
+module_param(my_rescan,int,S_IRUGO);
+
+// retry policy of the buses (defaults, changed for each bus in /sys/class/myDevice/bus<N>) :
+// reads again of a scratchpad with a bad CRC, sleep (us) before the first one (doubled for each next one),
+// conversions again when every read failed
+int my_retries = 4;
+module_param(my_retries,int,S_IRUGO);
+int my_backoff = 1000;
+module_param(my_backoff,int,S_IRUGO);
+int my_reconverts = 1;
+module_param(my_reconverts,int,S_IRUGO);
+
+// copy the configuration written (resolution, TH, TL) to the EEPROM of the sensors (Copy Scratchpad 0x48) :
+// it is kept at power on and read back at init
+int my_eeprom = 0;
+module_param(my_eeprom,int,S_IRUGO);
 
-// gpio define
-int my_gpio = GPIO_NUMBER;
-module_param(my_gpio,int,S_IRUGO);
-
-#define noDEBUG // if DEBUG is define => print of bits received
 #define DELAY_READ 60 // Delay read and write for 1wire
-#define DELAY_ERR 500 // Wait before the new demand when the data is corrupted 
-#define MAX_REPEAT_ERR 5 // Max repeat when error
-
-int my_resolution = 12; // resolution by default
-
-u64 device; // rom of device
-int my_minor = 0; // minor currently
-int nbDevice = 0; // number of device
+#define SLOT_TIMEOUT 500 // Max wait (us) of the bus going high at the end of a read slot
+#define MAX_REPEAT_ERR 5 // Max repeat when error (search)
+#define MAX_RETRIES 16 // Max of the retry policy (retries)
+#define MAX_RECONVERTS 4 // Max of the retry policy (reconverts)
+#define MAX_BACKOFF 100000 // Max sleep (us) between two attempts
+#define DELAY_CONV_POLL 2000 // Sleep (us) between two read slots during a conversion
+#define DELAY_COPY 10 // EEPROM write (ms) of Copy Scratchpad
+#define FAST_READ_DELTA 10000 // Max change (m°C) between two samples accepted without CRC
+#define BENCH_LOOPS 100 // Transactions of each kind timed by my_bench
+#define HIST_BUCKETS 21 // Latency histograms : bucket n counts [2^n, 2^(n+1)) us, the last one is open
+
+int nbDevice = 0; // number of device (all buses)
+
+
+// Counters of a sensor (debugfs), updated under the bus lock (reads and lastRead : sample lock)
+struct maSensorStats{
+    u32 reads; // samples stored
+    u32 crcErrors; // scratchpad reads with a bad CRC
+    u32 retries; // transactions repeated (CRC, configuration)
+    u32 resolutionErrors; // resolution read back different from the one expected
+    s64 lastRead; // CLOCK_MONOTONIC (ns) of the last sample, 0 if none
+    u32 conversion[HIST_BUCKETS]; // conversion time of its samples (us)
+    u32 transaction[HIST_BUCKETS]; // read-out time of its samples (us)
+};
 
+// Counters of a bus (debugfs), updated under the bus lock
+struct maBusStats{
+    u32 resets;
+    u32 noPresence; // resets without presence pulse (no sensor, or bus held low)
+    u32 slotTimeouts; // read slots where the bus stayed low (SLOT_TIMEOUT)
+    u32 searchRestarts; // passes of the search repeated after an error
+    u32 timeouts; // conversions not finished in time
+    s64 busy; // time (ns) the bus lock was held
+};
 
 // Structure of link list for each device
 struct maStructure{
+    struct maBus *bus; // bus of the device
     int minor;
     u64 device;
+    int resolution; // last resolution read
+    int th; // alarm thresholds (°C), TH and TL of the scratchpad
+    int tl;
+    bool configKnown; // resolution, TH and TL are the ones of the sensor (read or written)
+    bool alarm; // found by the last Alarm Search
+    bool seen; // found by the last rescan
+    bool removed; // unplugged, its node is deleted
+    int error; // result of its last read-out (0 or error), its sample is older when it failed
+    struct kref ref; // held by maListe and each open file
+    struct maSensorStats stats;
+    struct dentry *debug; // debugfs file of the stats
+    bool valid; // a temperature has been read
+    struct mutex sampleLock; // sample and ring
+    struct ds18b20_sample sample; // last temperature read
+    struct ds18b20_sample *ring; // the my_buffer last samples, sample n in ring[(n - 1) % my_buffer]
+    wait_queue_head_t wait; // woken up for each new sample
     struct list_head liste;
 };
 
-// Init
-static struct maStructure maListe;
+// State of an open file
+struct maSession{
+    struct maStructure *sensor; // sensor of the device node
+    int format; // DS18B20_FORMAT_TEXT, DS18B20_FORMAT_BINARY or DS18B20_FORMAT_STREAM
+    u32 seen; // number of the last sample read (text and binary)
+};
+
+struct maBus;
+
+// Retry policy of a bus
+struct maRetry{
+    int retries; // reads again of a scratchpad with a bad CRC (same conversion)
+    int backoff; // sleep (us) before the first retry, doubled for each next one
+    int reconverts; // conversions again when every read failed
+};
 
-struct maStructure *tmpListe;
-struct list_head *pos, *q;
+// Operations of a bus backend (1-Wire primitives)
+struct maBusOps{
+    const char *name;
+    int (*init)(struct maBus *bus);
+    void (*release)(struct maBus *bus);
+    int (*reset)(struct maBus *bus); // 0 (presence pulse), -ENXIO (no sensor answers) or -EIO (bus held low)
+    void (*writeBit)(struct maBus *bus, int bit);
+    int (*readBit)(struct maBus *bus); // 0, 1 or -EIO when the bus stays low after the slot
+    int (*triplet)(struct maBus *bus, int direction); // optional, else read, read, write
+};
+
+// Simulated bus
+#define SIM_MAX_SENSORS 64
+
+enum {
+    SIM_IDLE, // waiting for a reset
+    SIM_ROM_CMD,
+    SIM_MATCH_ROM,
+    SIM_SEARCH,
+    SIM_FUNC_CMD,
+    SIM_CONVERT,
+    SIM_READ_SCRATCHPAD,
+    SIM_WRITE_SCRATCHPAD,
+    SIM_POWER,
+};
+
+struct maSimSensor{
+    u64 rom;
+    u8 scratchpad[9];
+    u8 eeprom[3]; // TH, TL, configuration
+    int millidegrees; // temperature of the next conversion
+    ktime_t convEnd; // end of the conversion
+    bool alarm; // alarm flag of the last conversion
+    bool selected; // by the ROM command, or still in the search
+};
+
+struct maSim{
+    int nb;
+    struct maSimSensor sensors[SIM_MAX_SENSORS];
+    int state;
+    u8 byte; // bits of the byte received
+    int bits;
+    int pos; // bit of the ROM (match, search) or of the scratchpad, byte written in the scratchpad
+    int step; // search : 0 bit, 1 complement, 2 direction
+    u64 match; // ROM received by Match ROM
+    u32 errors; // bit errors injected
+};
+
+// Structure for each bus (one GPIO)
+struct maBus{
+    int id;
+    int gpio;
+    const struct maBusOps *ops; // backend
+    struct maSim *sim; // simulated backend
+    struct maStructure maListe; // devices of the bus
+    int nbDevice; // number of device on the bus
+    struct mutex lock; // held for each 1-Wire transaction (conversion and read-out of a sensor)
+    int externalPower; // all sensors have an external power (Read Power Supply)
+    int errSearch; // Counts errors when searching for device
+    int fault; // -EIO when a read slot did not end (bus held low), until the next reset
+    struct maRetry retry; // retry policy (sysfs)
+    struct task_struct *sampler; // Background sampling thread
+    ktime_t searchTime; // duration of the search at init
+    struct device *dev; // /sys/class/myDevice/bus<N> (rescan)
+    ktime_t lockTime; // when the bus lock was taken
+    u32 sweeps; // sweeps finished (under the lock), a reader waiting for the lock uses the one done meanwhile
+    struct maBusStats stats;
+};
+
+// Init
+static struct maBus buses[MAX_BUS];
 
-// Mutex
-struct mutex lock;
 
 // UDEV
 static struct class *myClass;
 
+// Minors of the sensors : a removed sensor keeps its minor, given back when its ROM comes back
+static DEFINE_MUTEX(sensorsLock); // minors and maListe of the buses (also under the bus lock)
+static struct maStructure *minors[MAX_DEVICE]; // sensor of each minor, NULL if free
+static u64 minorRom[MAX_DEVICE]; // ROM of each minor, 0 if never used
+
+// /sys/kernel/debug/ds18b20 : stats of the buses and of the sensors
+static struct dentry *debugDir;
+
+// Last sample of each sensor shared with user space (mmap)
+static struct ds18b20_shm *shm;
+static unsigned long shmSize;
 
-// Counts errors when searching for device
-int errSearch = 0; 
 
 
 
@@ -113,20 +334,39 @@ static ssize_t gpio_read(struct file *f, char *buf, size_t size, loff_t *offset)
 static ssize_t gpio_write(struct file *f, const char *buf, size_t size, loff_t *offset);
 static int gpio_open(struct inode *in, struct file *f);
 static int gpio_release(struct inode *in, struct file *f);
+static long gpio_ioctl(struct file *f, unsigned int cmd, unsigned long arg);
+static int gpio_mmap(struct file *f, struct vm_area_struct *vma);
+static __poll_t gpio_poll(struct file *f, poll_table *wait);
 
 // Find the sensors
-static int search(void);
+static int search(struct maBus *bus);
+// Find the sensors in alarm
+static int alarmSearch(struct maBus *bus);
+// Search the bus again, add and remove sensors
+static int rescanBus(struct maBus *bus);
 
 // Send one byte
-static int send(unsigned char n);
+static int send(struct maBus *bus, unsigned char n);
 // Send 8 bytes
-static int sendRom(u64 device);
-
-// Read n bit(s)
-static int read(int n);
-
-// Reset of 1wire
-static void reset(void);
+static int sendRom(struct maBus *bus, u64 device);
+
+// Read n bytes
+static void readBytes(struct maBus *bus, u8 *data, int n);
+// Write n bytes
+static void writeBytes(struct maBus *bus, const u8 *data, int n);
+// Write n bytes, not traced
+static void writeSlots(struct maBus *bus, const u8 *data, int n);
+// CRC of n bytes
+static u8 crc8(const u8 *data, int n);
+// Read one bit
+static int readBit(struct maBus *bus);
+// Write one bit
+static void writeBit(struct maBus *bus, int bit);
+// Search ROM step
+static int triplet(struct maBus *bus, int direction);
+
+// Reset of 1wire, 0 when a sensor answers
+static int reset(struct maBus *bus);
 
 // standard file_ops for char driver 
 static struct file_operations fops = 
@@ -135,6 +375,11 @@ static struct file_operations fops =
   .write = gpio_write,
   .open = gpio_open,
   .release = gpio_release,
+  .unlocked_ioctl = gpio_ioctl,
+  .compat_ioctl = compat_ptr_ioctl, // 32-bit user space : same layout of the structures
+  .mmap = gpio_mmap,
+  .poll = gpio_poll,
+  .llseek = default_llseek, // text : back to 0 for the next sample, stream : to a sample (n * sizeof(struct ds18b20_sample))
 };
 
 
@@ -145,812 +390,2616 @@ dev_t dev;
 struct cdev *my_cdev;
 
 
-// read of temperature (DS18B20)
-static ssize_t gpio_read(struct file *f, char *buf, size_t size, loff_t *offset) {
-    // get bytes to read temperature
-    u8 upper;
-    u8 lower;
-    u8 resolution;
+// Take the lock of a bus for a 1-Wire transaction
+// the id is the lockdep subclass : /dev/myDevice/all holds the locks of all buses, in order
+static void lockBus(struct maBus *bus) {
+    mutex_lock_nested(&bus->lock, bus->id);
+    bus->lockTime = ktime_get();
+}
 
-    // check data
-    u8 crc;
-    u8 tmp;
+// Release the lock of a bus, count the busy time
+static void unlockBus(struct maBus *bus) {
+    bus->stats.busy += ktime_to_ns(ktime_sub(ktime_get(), bus->lockTime));
+    mutex_unlock(&bus->lock);
+}
 
-    // tempory data
-    int i;
-    int val;
+// Add a duration to a latency histogram
+static void histAdd(u32 *hist, ktime_t duration) {
+    s64 us = ktime_to_us(duration);
 
-    // temperature
-    int temp;
-    int temp_float;
+    hist[us > 0 ? min_t(int, ilog2(us), HIST_BUCKETS - 1) : 0]++;
+}
 
-    int err;
-     
-    printk(KERN_INFO "mydevice : >>> GPIO READ called\n");
+// Conversion time (ms) for a resolution
+static int conversionDelay(int resolution) {
+    if (resolution == 9)
+        return 150;
+    else if (resolution == 10)
+        return 200;
+    else if (resolution == 11)
+        return 400;
+    return 800;
+}
 
+// Resolution (9 to 12) from the configuration register, -1 if invalid
+static int resolutionFromConfig(u8 config) {
+    if (config == 0b00011111)
+        return 9;
+    else if (config == 0b00111111)
+        return 10;
+    else if (config == 0b01011111)
+        return 11;
+    else if (config == 0b01111111)
+        return 12;
+    return -1;
+}
 
-    // reset
-    reset();
-    
-    // Send Ox55 (chose sensor)
-    send(0x55);
-    
-    sendRom(device);
-    
-    
-    // send 0x44 (conv temperature)
-    send(0x44);
+// Select one sensor (Match ROM) or all sensors of the bus (Skip ROM when rom == 0)
+static void selectRom(struct maBus *bus, u64 rom) {
+    if (rom) {
+        // Send Ox55 (chose sensor)
+        send(bus, 0x55);
+        sendRom(bus, rom);
+    } else {
+        // Send 0xCC (all sensors)
+        send(bus, 0xCC);
+    }
+}
 
-    // Wait 1
-    gpio_direction_output(my_gpio, 0);
-    udelay(1);        
-    gpio_direction_input(my_gpio);
-    udelay(10);
+// Read Power Supply (0xB4) for all sensors
+// @return 1 if every sensor has an external power, 0 if one sensor is parasite powered
+static int readPowerSupply(struct maBus *bus) {
+    int power;
 
-    while (gpio_get_value(my_gpio) == 0) {
-        udelay(DELAY_READ);
-        gpio_direction_output(my_gpio, 0);
-        udelay(1);
-        gpio_direction_input(my_gpio);
-        udelay(10);
-    }
+    // no sensor : parasite, the conversion time is waited
+    if (reset(bus))
+        return 0;
 
+    selectRom(bus, 0);
 
-    udelay(DELAY_READ);
+    send(bus, 0xB4);
 
-    // Add delay for conversion
-    if (my_resolution == 9)
-        mdelay(150);
-    else if (my_resolution == 10)
-        mdelay(200);
-    else if (my_resolution == 11)
-        mdelay(400);
-    else
-        mdelay(800);
-    
-    
-    upper = 0;
-    lower = 0;
-    resolution = 0;
+    // a parasite powered sensor pulls the bus low
+    power = readBit(bus);
 
-    crc = 0x00;
-    tmp = 0xff;
-    
-    err = 0;
-    
-    // repeat MAX_REPEAT_ERR times when crc is bad
-    while (crc != tmp && err < MAX_REPEAT_ERR) {
+    return bus->fault ? 0 : power;
+}
 
-        crc = 0x00;
-        tmp = 0x00;
-    
-        // Reset
-        reset();
+// Start a conversion (0x44), rom == 0 : broadcast conversion, every sensor converts in the same window
+// @return 0 or the error of the reset
+static int convertStart(struct maBus *bus, u64 rom) {
+    int err;
 
+    // reset
+    if ((err = reset(bus)))
+        return err;
 
-        // Send Ox55 (chose sensor)
-        send(0x55);
-        
-        sendRom(device);
-        
-        
-        // send 0xBE  10111110
-        // Receive rom of device
-
-        send(0xBE);
-
-        printk(KERN_INFO "mydevice : read 64 bits\n");
-
-
-        for (i = 0; i < 72; i++) {
-            #ifdef DEBUG
-                if (i%8 == 0) {
-                    printk(KERN_INFO "\n");
-                    printk(KERN_INFO "mydevice : value : ");
-                }
-            #endif
-            gpio_direction_output(my_gpio, 0);
-            udelay(1);
-            gpio_direction_input(my_gpio);
-            udelay(5);
-            val = gpio_get_value(my_gpio);
-            #ifdef DEBUG
-                printk(KERN_INFO "%i ", val);
-            #endif
-            if (i < 8)
-            upper += val << i;
-            if (i >= 8 && i < 16)
-                lower += val << (i % 8);
-            if (i >= 32 && i < 40)
-                resolution += val << (i % 32);
-            udelay(DELAY_READ);
-            
-            gpio_direction_input(my_gpio);
-            while (gpio_get_value(my_gpio) != 1);
-
-            
-
-            if (i%8 == 0 && i > 0 &&  i <= 64) {
-                //printk(KERN_INFO "tmp 0x%x\n", tmp);
-                crc ^= tmp;
-                //printk(KERN_INFO "crc before %i :  0x%x\n", (int)crc, crc);
-                crc = crc7_syndrome_table[(int)crc];
-                //printk(KERN_INFO "crc after 0x%x\n", crc);
-                tmp = 0;
-            }
+    selectRom(bus, rom);
+
+    // send 0x44 (conv temperature)
+    send(bus, 0x44);
 
-            if (i < 64)
-                tmp += val << (i % 8);
+    return 0;
+}
 
-            if (i == 64)
-                tmp = 0;
-            if (i >= 64) {
-                tmp += val << (i % 8);
+// Wait for the end of a conversion started at start, sleeping (the CPU is given back)
+// @return 0 or -ETIMEDOUT when the sensors never release the bus
+static int convertWait(struct maBus *bus, u64 rom, int resolution, ktime_t start) {
+    unsigned long timeout;
+    s64 left;
+    int err = 0;
+
+    // Parasite power : the bus cannot be polled, sleep the rest of the conversion time
+    if (!bus->externalPower) {
+        left = conversionDelay(resolution) - ktime_to_ms(ktime_sub(ktime_get(), start));
+        if (left > 0)
+            msleep(left);
+    } else {
+        // External power : the sensors answer 0 to a read slot until the end of the conversion
+        timeout = jiffies + msecs_to_jiffies(conversionDelay(resolution) * 2);
+
+        while (readBit(bus) == 0) {
+            if (time_after(jiffies, timeout)) {
+                printk(KERN_ERR "mydevice : conversion timeout\n");
+                bus->stats.timeouts++;
+                err = -ETIMEDOUT;
+                break;
             }
+            usleep_range(DELAY_CONV_POLL, 2 * DELAY_CONV_POLL);
         }
 
-        if (crc == tmp)
-            printk(KERN_INFO "mydevice : CRC ok\n");
-        else {
-            printk(KERN_ERR "mydevice : CRC ko\n");
-            err++;
-            mdelay(DELAY_ERR);
-        }
+        // bus held low : the end of the conversion is unknown
+        if (bus->fault)
+            err = bus->fault;
     }
 
-    if (err == 5)
-        return -EBADE;
-            
-
-    // Calculate the resolution
-
-    if (resolution == 0b00011111)
-        my_resolution = 9;
-    else if (resolution == 0b00111111)
-        my_resolution = 10;
-    else if (resolution == 0b01011111)
-        my_resolution = 11;
-    else if (resolution == 0b01111111)
-        my_resolution = 12;
-    else 
-    {
-        printk(KERN_ERR "mydevice : error resoltion\n");
-        return -1;
-    }
-    
-    printk(KERN_INFO "mydevice : resolution : %i\n", my_resolution);
+    trace_ds18b20_conversion(bus->id, rom, resolution, ktime_to_us(ktime_sub(ktime_get(), start)), err);
 
+    return err;
+}
 
-    // Calculate the temperature
+// Start a conversion and wait for the end
+// @return 0, -ETIMEDOUT or the error of the reset
+static int convert(struct maBus *bus, u64 rom, int resolution) {
+    ktime_t start = ktime_get();
+    int err;
 
-    printk(KERN_INFO "mydevice : upper : 0x%x\n", upper);
-    printk(KERN_INFO "mydevice : lower : 0x%x\n", lower);
+    if ((err = convertStart(bus, rom)))
+        return err;
 
-    temp = 0;
-    temp_float = 0;
-    
-    if (my_resolution > 11 && upper & 0x01)
-        temp_float += 63;
+    return convertWait(bus, rom, resolution, start);
+}
 
-    if (my_resolution > 10 && upper & 0x02)
-        temp_float += 125;
+// Sleep before the retry n (1 for the first one) of the policy of the bus, the CPU is given back
+static void backoff(struct maBus *bus, int n) {
+    unsigned long us = bus->retry.backoff;
 
-    if (my_resolution > 9 && upper & 0x04)
-        temp_float += 250;
+    while (--n > 0 && us < MAX_BACKOFF)
+        us *= 2;
+    us = min_t(unsigned long, us, MAX_BACKOFF);
 
-    if (upper & 0x08)
-        temp_float += 500;
-    
+    if (us)
+        usleep_range(us, us + us / 4);
+}
 
-    if (upper & 0x10)
-        temp += 1;
+// Read the scratchpad of one sensor (0xBE), check the CRC
+// A bad CRC is read again (no new conversion) retry.retries times, with backoff
+// @return 0, -EBADE when the CRC stays bad, or the error of the reset (no retry)
+static int readScratchpad(struct maStructure *s, u8 *scratchpad) {
+    struct maBus *bus = s->bus;
+    u64 rom = s->device;
+    int err = 0;
+    int presence;
 
-    if (upper & 0x20)
-        temp += 2;
+    while (true) {
+        if ((presence = reset(bus)))
+            return presence;
 
-    if (upper & 0x40)
-        temp += 4;
-        
-    if (upper & 0x80)
-        temp += 8;
-    
+        selectRom(bus, rom);
 
-    if (lower & 0x01)
-        temp += 16;
+        // send 0xBE  10111110, receive the 9 bytes of the scratchpad
+        send(bus, 0xBE);
+        readBytes(bus, scratchpad, 9);
 
-    if (lower & 0x02)
-        temp += 32;
+        // bus held low : no retry
+        if (bus->fault)
+            return bus->fault;
 
-    if (lower & 0x04)
-        temp += 64;
+        if (crc8(scratchpad, 8) == scratchpad[8]) {
+            trace_ds18b20_crc(bus->id, rom, true);
+            return 0;
+        }
 
+        trace_ds18b20_crc(bus->id, rom, false);
+        printk(KERN_ERR "mydevice : device %i, CRC ko\n", s->minor);
+        s->stats.crcErrors++;
 
-    if (lower & 0xf0)
-        temp *= -1;
+        if (++err > bus->retry.retries)
+            return -EBADE;
+        s->stats.retries++;
+        backoff(bus, err);
+    }
+}
 
+// Temperature (m°C) from the scratchpad (byte 0 = LSB, byte 1 = MSB, two's complement in 1/16 °C)
+static int toMillidegrees(const u8 *scratchpad, int resolution) {
+    s16 raw = (s16)(scratchpad[0] | (scratchpad[1] << 8));
 
-    if (temp_float == 63)
-        printk(KERN_INFO "mydevice : temperature : %i.0%i °C\n", temp, temp_float);
-    else
-        printk(KERN_INFO "mydevice : temperature : %i.%i °C\n", temp, temp_float);
+    // undefined bits for a low resolution
+    raw &= ~((1 << (12 - resolution)) - 1);
 
-    
-    
-   
-    
-    return 0;
+    return raw * 1000 / 16;
 }
 
-// Change resolution of DS18B20
-static ssize_t gpio_write(struct file *f, const char *buf, size_t size, loff_t *offset) {
-    int err, err2;
-    int i;
-    int val;
+// Publish the last sample of a sensor in the shared memory
+static void publishSample(struct maStructure *s) {
+    struct ds18b20_shm_slot *slot;
 
-    u8 resolution;
+    if (!shm || s->minor >= shm->count)
+        return;
 
-    u8 crc;
-    u8 tmp;
+    slot = &shm->slots[s->minor];
 
-    printk(KERN_INFO "mydevice : >>> GPIO WRITE called\n");
+    WRITE_ONCE(slot->seq, slot->seq + 1);
+    smp_wmb();
+    slot->sample = s->sample;
+    smp_wmb();
+    WRITE_ONCE(slot->seq, slot->seq + 1);
+}
 
-    if ( (err = kstrtoint(buf,10, &my_resolution)) )
-        printk(KERN_ERR "mydevice : Error conversion : %i\n", err);
+// Keep the last sample of a sensor
+static void storeSample(struct maStructure *s, const u8 *scratchpad, int resolution) {
+    mutex_lock(&s->sampleLock);
 
-    printk(KERN_INFO "mydevice : value %i\n", my_resolution);
+    s->resolution = resolution;
 
+    s->sample.timestamp = ktime_get_ns();
+    s->sample.seq++;
+    s->sample.millidegrees = toMillidegrees(scratchpad, resolution);
+    memcpy(s->sample.scratchpad, scratchpad, sizeof(s->sample.scratchpad));
+    s->sample.resolution = resolution;
 
-    err = 0;
+    s->ring[(s->sample.seq - 1) % my_buffer] = s->sample;
 
-    while (err < MAX_REPEAT_ERR) {
+    s->stats.reads++;
+    s->stats.lastRead = s->sample.timestamp;
 
-        // reset
+    publishSample(s);
 
-        reset();
+    // before the wake up : a woken reader finds the sample
+    s->valid = true;
+    s->error = 0;
 
-        // Send Ox55 (chose sensor)
-        send(0x55);
-        
-        sendRom(device);
-        
+    mutex_unlock(&s->sampleLock);
 
-        // send 0x4E
+    wake_up_interruptible(&s->wait);
+}
 
-        send(0x4E);
+// Temperature as text : "-1.250\n"
+static int formatSample(char *buf, size_t size, const struct ds18b20_sample *sample) {
+    int m = sample->millidegrees;
 
-        // send 0x00 0x00 
+    return scnprintf(buf, size, "%s%i.%03i\n", m < 0 ? "-" : "", abs(m) / 1000, abs(m) % 1000);
+}
 
-        send(0x00);
-        send(0x00);
+// Print the temperature
+static void printTemperature(const struct maStructure *s) {
+    char text[16];
 
-        // send resolution
+    formatSample(text, sizeof(text), &s->sample);
+    pr_debug("mydevice : device %i, resolution %i, temperature : %s", s->minor, s->resolution, text);
+}
 
-        if (my_resolution == 9)
-            send(0b00011111);
-        else if (my_resolution == 10)
-            send(0b00111111);
-        else if (my_resolution == 11)
-            send(0b01011111);
-        else if (my_resolution == 12)
-            send(0b01111111);
-        else
-            printk(KERN_ERR "mydevice : Error value\n");
+// Read only the temperature (2 first bytes of the scratchpad), then stop the transfer with a reset
+// @return 0 or the error of the reset
+static int readTemperature(struct maBus *bus, u64 rom, u8 *scratchpad) {
+    int err;
 
-        
-        mdelay(2000);
+    if ((err = reset(bus)))
+        return err;
 
+    selectRom(bus, rom);
 
-        // check up
+    send(bus, 0xBE);
+    readBytes(bus, scratchpad, 2);
+    err = bus->fault;
 
-        crc = 0x00;
-        tmp = 0xff;
-        err2 = 0;
-
-        while (crc != tmp && err2 < MAX_REPEAT_ERR) {
-
-            crc = 0x00;
-            tmp = 0x00;
-
-            reset();
-            // Send Ox55 (chose sensor)
-            
-            send(0x55);
-            sendRom(device);
-            
-            
-            // send 0xBE  10111110
-            // Receive rom of device
-            send(0xBE);
-
-            for (i=0;i<72;i++) {
-                #ifdef DEBUG
-                    if (i%8 == 0) {
-                        printk(KERN_INFO "\n");
-                        printk(KERN_INFO "mydevice : value : ");
-                    }
-                #endif
-
-                gpio_direction_output(my_gpio, 0);
-                udelay(1);
-                gpio_direction_input(my_gpio);
-                udelay(5);
-                val = gpio_get_value(my_gpio);
-
-                #ifdef DEBUG
-                    printk(KERN_INFO "%i ", val);
-                #endif
-
-                if (i >= 32 && i < 40)
-                    resolution += val << (i % 32);
-                udelay(DELAY_READ);
-                
-                gpio_direction_input(my_gpio);
-                while (gpio_get_value(my_gpio) != 1);
-
-                if (i%8 == 0 && i > 0 &&  i <= 64) {
-                    //printk(KERN_INFO "tmp 0x%x\n", tmp);
-                    crc ^= tmp;
-                    //printk(KERN_INFO "crc before %i :  0x%x\n", (int)crc, crc);
-                    crc = crc7_syndrome_table[(int)crc];
-                    //printk(KERN_INFO "crc after 0x%x\n", crc);
-                    tmp = 0;
-                }
-
-                if (i < 64)
-                    tmp += val << (i % 8);
-
-                if (i == 64)
-                    tmp = 0;
-                if (i >= 64) {
-                    tmp += val << (i % 8);
-                }
-            }
-            
-            if (crc == tmp)
-                printk(KERN_INFO "mydevice : CRC ok\n");
-            else {
-                printk(KERN_ERR "mydevice : CRC ko\n");
-                err2++;
-                mdelay(DELAY_ERR);
-            }
+    // the sensor stops sending the scratchpad
+    reset(bus);
 
-        }
+    return err;
+}
 
-        if (err2 == 5)
-            return -EBADE;
+// Check a temperature read without CRC against the last sample
+static bool plausible(const struct maStructure *s, const u8 *scratchpad) {
+    int temp = toMillidegrees(scratchpad, s->resolution);
 
-        if (resolution == 0b00011111 && my_resolution == 9) {
-            printk(KERN_INFO "mydevice : resolution ok \n");
-            return size;
-        }  
-        else if (resolution == 0b00111111 && my_resolution == 10) {
-            printk(KERN_INFO "mydevice : resolution ok \n");
-            return size;
-        }
-        else if (resolution == 0b01011111 && my_resolution == 11) {
-            printk(KERN_INFO "mydevice : resolution ok \n");
-            return size;
-        }    
-        else if (resolution == 0b01111111 && my_resolution == 12) {
-            printk(KERN_INFO "mydevice : resolution ok \n");
-            return size;
-        }
-        
-        printk(KERN_ERR "mydevice : resolution ko \n");
-        err++;
+    // bus held high (no answer)
+    if (scratchpad[0] == 0xff && scratchpad[1] == 0xff)
+        return false;
 
-        mdelay(DELAY_ERR);
-    }
+    // range of the DS18B20
+    if (temp < -55000 || temp > 125000)
+        return false;
 
-    return -ECOMM;
+    return abs(temp - s->sample.millidegrees) <= FAST_READ_DELTA;
 }
 
-// When open device
-static int gpio_open(struct inode *in, struct file *f) {
-    
-    printk(KERN_INFO "mydevice : >>> GPIO OPEN called\n");
+// Read the scratchpad of a sensor after a conversion
+// my_fast_read : only the temperature when there is a last sample to compare with, else the full scratchpad
+// When the reads again of the scratchpad fail, the sensor converts again (retry.reconverts times)
+// @return 0 or error, the resolution of the sensor in *resolution
+static int readSensor(struct maStructure *s, u8 *scratchpad, int *resolution) {
+    struct maBus *bus = s->bus;
+    int err;
+    int n;
 
-    mutex_lock(&lock);
+    if (my_fast_read && s->valid) {
+        // the other bytes are the ones of the last full read
+        memcpy(scratchpad, s->sample.scratchpad, sizeof(s->sample.scratchpad));
 
-    if (MINOR(in->i_rdev) != my_minor || device == 0) {
-        my_minor = MINOR(in->i_rdev);
-        list_for_each_safe(pos, q, &maListe.liste){
-            tmpListe = list_entry(pos, struct maStructure, liste);
-            if (tmpListe->minor == my_minor) {
-                device = tmpListe->device;
-            }
+        if ((err = readTemperature(bus, s->device, scratchpad)))
+            return err;
+
+        if (plausible(s, scratchpad)) {
+            *resolution = s->resolution;
+            return 0;
         }
+
+        pr_debug("mydevice : device %i, fast read not plausible, full read\n", s->minor);
     }
 
-    return 0;
-}
+    for (n = 0; (err = readScratchpad(s, scratchpad)) == -EBADE && n < bus->retry.reconverts; n++) {
+        printk(KERN_INFO "mydevice : device %i, conversion again\n", s->minor);
+        s->stats.retries++;
+        if ((err = convert(bus, s->device, s->resolution)))
+            return err;
+    }
+    if (err)
+        return err;
 
-// When close device
-static int gpio_release(struct inode *in, struct file *f) {
-    printk(KERN_INFO "mydevice : >>> GPIO RELEASE called\n");
+    // Calculate the resolution
+    *resolution = resolutionFromConfig(scratchpad[4]);
+
+    if (*resolution < 0)
+    {
+        printk(KERN_ERR "mydevice : error resoltion\n");
+        return -EIO;
+    }
+
+    // configuration lost (power on reset) or changed by another master
+    if (s->valid && *resolution != s->resolution) {
+        s->stats.resolutionErrors++;
+        s->configKnown = false;
+    }
 
-    mutex_unlock(&lock);
+    // TH and TL back to the EEPROM values (power on reset without my_eeprom) : written again when asked
+    if ((s8)scratchpad[2] != s->th || (s8)scratchpad[3] != s->tl)
+        s->configKnown = false;
 
     return 0;
 }
 
+// Read TH, TL and the resolution of a sensor from its scratchpad
+static int readConfig(struct maStructure *s) {
+    u8 scratchpad[9];
+    int resolution;
+    int err;
 
-// Send one byte
-static int send(unsigned char n) {
-    int i;
-    unsigned char c = 1;
-
-    printk(KERN_INFO "mydevice : send 0x%x\n", n);
-
-    for (i = 0; i < 8; i++) {
-        if (n & (c << i)) {
-            gpio_direction_output(my_gpio, 0);
-            udelay(15);
-            gpio_direction_input(my_gpio);
-            udelay(45);
-            gpio_direction_input(my_gpio);
-            //printk(KERN_INFO "1");
-        } else {
-            gpio_direction_output(my_gpio, 0);
-            udelay(60);
-            gpio_direction_input(my_gpio);
-            //printk(KERN_INFO "0");
-        }
-    }
+    if ((err = readScratchpad(s, scratchpad)))
+        return err;
 
-    return 0;
-}
+    resolution = resolutionFromConfig(scratchpad[4]);
+    if (resolution < 0)
+        return -EIO;
 
-// Send 8 bytes (for rom device)
-static int sendRom(u64 device) {
-    int i;
-    printk(KERN_INFO "mydevice : send Rom\n");
-
-    for (i=0; i<64;i++) {
-        if (device & ((u64)1 << i)) {
-            gpio_direction_output(my_gpio, 0);
-            udelay(15);
-            gpio_direction_input(my_gpio);
-            udelay(45);
-            gpio_direction_input(my_gpio);
-            //printk(KERN_INFO "mydevice : 1\n");
-        } else {
-            gpio_direction_output(my_gpio, 0);
-            udelay(60);
-            gpio_direction_input(my_gpio);
-            //printk(KERN_INFO "mydevice : 0\n");
-        }
-    }
+    s->th = (s8)scratchpad[2];
+    s->tl = (s8)scratchpad[3];
+    s->resolution = resolution;
+    s->configKnown = true;
 
     return 0;
 }
 
-// Read n bit(s)
-static int read(int n) {
-    int i, val;
-    
-    printk(KERN_INFO "mydevice : read %i bits\n", n);
-    
-    for (i = 0; i < n; i++) {
-        #ifdef DEBUG
-            if (i%8 == 0) {
-                printk(KERN_INFO "\n");
-                printk(KERN_INFO "mydevice : value : ");
-            }
-        #endif
-        gpio_direction_output(my_gpio, 0);
-        udelay(1);
-        gpio_direction_input(my_gpio);
-        udelay(5);
-        val = gpio_get_value(my_gpio);
-        #ifdef DEBUG
-            printk(KERN_INFO "%i ", val);
-        #endif
-        udelay(DELAY_READ);
+// Write TH, TL and the resolution in the scratchpad (0x4E) of one sensor, or of all sensors (rom == 0)
+// @return 0 or the error of the reset
+static int writeScratchpad(struct maBus *bus, u64 rom, int th, int tl, int resolution) {
+    // 0x4E, TH, TL, configuration
+    // R1 R0 in bits 6 5 : 0b00011111 for 9 bits to 0b01111111 for 12 bits
+    u8 command[4] = { 0x4E, (s8)th, (s8)tl, ((resolution - 9) << 5) | 0x1F };
+    int err;
+
+    if ((err = reset(bus)))
+        return err;
+    selectRom(bus, rom);
+    writeBytes(bus, command, sizeof(command));
 
-        gpio_direction_input(my_gpio);
-        while (gpio_get_value(my_gpio) != 1);
-    }
     return 0;
 }
 
-// Reset of 1wire
-static void reset(void) {
-    printk(KERN_INFO "mydevice : reset 1wire called\n");
+// Copy Scratchpad (0x48) : TH, TL and configuration to the EEPROM of one sensor, or of all sensors (rom == 0)
+static void copyScratchpad(struct maBus *bus, u64 rom) {
+    if (reset(bus))
+        return;
+    selectRom(bus, rom);
+    send(bus, 0x48);
 
-    gpio_direction_output(my_gpio, 0);
-    udelay(480);
-    gpio_direction_input(my_gpio);
-    udelay(480);
+    // the bus stays high during the EEPROM write (parasite power)
+    msleep(DELAY_COPY);
 }
 
-// Search all device (DS18B20)
-// @return number of device
-static int search(void) {
-    int i = 0; // For loop
-    int r = 0; // result of the response of slave 
-    int n = 0; // start where the conflict
-    int b = 0; // save place of first conflict
-    int nbDevice = 0;
-    u8 family = 0x28; // number of family at DS18B20
-
-    u8 crc, tmp;
-
-    printk(KERN_INFO "mydevice : search device (DS18B20)\n");
+// The configuration of the sensor is already this one, nothing to write
+static bool unchanged(const struct maStructure *s, int th, int tl, int resolution) {
+    return s->configKnown && s->resolution == resolution && s->th == th && s->tl == tl;
+}
 
-    // DS18B20, 0x28 called
+// The scratchpad holds this configuration
+static bool configured(const u8 *scratchpad, int th, int tl, int resolution) {
+    return resolutionFromConfig(scratchpad[4]) == resolution && (s8)scratchpad[2] == th && (s8)scratchpad[3] == tl;
+}
 
-    device = 0;
+// Write TH, TL and the resolution of a sensor (0x4E), check them with a read of the scratchpad
+// The scratchpad is written at once : it is read back in the same transaction, without wait
+// (with my_eeprom, then copied to the EEPROM)
+static int writeConfig(struct maStructure *s, int th, int tl, int resolution) {
+    struct maBus *bus = s->bus;
+    int err = 0;
+    int presence; // error of the transaction
+    u8 scratchpad[9];
 
-    device += family;
+    if (s->removed)
+        return -ENODEV;
 
-    b = 0;
-    n = 8;
+    if (unchanged(s, th, tl, resolution)) {
+        pr_debug("mydevice : device %i, configuration unchanged\n", s->minor);
+        return 0;
+    }
 
     while (true) {
 
-        crc = 0x00;
-        tmp = 0x00;
-
-        reset();
-        send(0xF0);
+        lockBus(bus);
 
-        for (i = 0; i < n; i++) {
-
-            if (i%8 == 0 && i > 0 &&  i <= 56) {
-                //printk(KERN_INFO "tmp 0x%x\n", tmp);
-                crc ^= tmp;
-                //printk(KERN_INFO "crc before %i :  0x%x\n", (int)crc, crc);
-                crc = crc7_syndrome_table[(int)crc];
-                //printk(KERN_INFO "crc after 0x%x\n", crc);
-                tmp = 0;
-            }
+        // check up
+        if ((presence = writeScratchpad(bus, s->device, th, tl, resolution)) || (presence = readScratchpad(s, scratchpad))) {
+            unlockBus(bus);
+            return presence;
+        }
 
-            gpio_direction_output(my_gpio, 0);
-            udelay(1);        
-            gpio_direction_input(my_gpio);
-            udelay(10);
-            udelay(DELAY_READ);
-
-            while (gpio_get_value(my_gpio) != 1);
-
-            gpio_direction_output(my_gpio, 0);
-            udelay(1);        
-            gpio_direction_input(my_gpio);
-            udelay(10);
-            udelay(DELAY_READ);
-
-            while (gpio_get_value(my_gpio) != 1);
-
-
-            if (device & ((u64)1 << i)) {
-                //write 1
-                gpio_direction_output(my_gpio, 0);
-                udelay(15);
-                gpio_direction_input(my_gpio);
-                udelay(45);
-                gpio_direction_input(my_gpio);
-                //printk(KERN_INFO "mydevice : 1\n");
-                
-                tmp += 1 << (i % 8);
-            } else {
-                // write 0
-                gpio_direction_output(my_gpio, 0);
-                udelay(60);
-                gpio_direction_input(my_gpio);
-                //printk(KERN_INFO "mydevice : 0\n");
-            }
+        if (configured(scratchpad, th, tl, resolution)) {
+            if (my_eeprom)
+                copyScratchpad(bus, s->device);
+            unlockBus(bus);
+
+            pr_debug("mydevice : configuration ok \n");
+            s->th = th;
+            s->tl = tl;
+            s->resolution = resolution;
+            s->configKnown = true;
+            return 0;
         }
 
-        for (i=n;i<64;i++) {
-            if (device & ((u64)1 << i))
-                device += (u64)1 << i;
+        unlockBus(bus);
+        
+        printk(KERN_ERR "mydevice : configuration ko \n");
+        s->stats.resolutionErrors++;
 
-            r = 0;
+        if (++err > bus->retry.retries)
+            return -ECOMM;
+        s->stats.retries++;
+        backoff(bus, err);
+    }
+}
 
-            if (i%8 == 0 && i > 0 &&  i <= 56) {
-                //printk(KERN_INFO "tmp 0x%x\n", tmp);
-                crc ^= tmp;
-                //printk(KERN_INFO "crc before %i :  0x%x\n", (int)crc, crc);
-                crc = crc7_syndrome_table[(int)crc];
-                //printk(KERN_INFO "crc after 0x%x\n", crc);
-                tmp = 0;
-            }
+// Start the broadcast conversion of a sweep : Skip ROM 0xCC + 0x44 (all sensors convert together)
+// @return resolution of the slowest sensor, 0 if the bus has no sensor, or the error of the reset (no conversion)
+static int sweepStart(struct maBus *bus, ktime_t *start) {
+    struct maStructure *s;
+    int resolution = 9;
+    int err;
 
-            gpio_direction_output(my_gpio, 0);
-            udelay(1);        
-            gpio_direction_input(my_gpio);
-            udelay(10);
-            if (gpio_get_value(my_gpio) == 0)
-                r += 1;
-            udelay(DELAY_READ);
-
-            while (gpio_get_value(my_gpio) != 1);
-
-            gpio_direction_output(my_gpio, 0);
-            udelay(1);        
-            gpio_direction_input(my_gpio);
-            udelay(10);
-            if (gpio_get_value(my_gpio) == 0)
-                r += 2;
-            udelay(DELAY_READ);
-
-            while (gpio_get_value(my_gpio) != 1);
-
-            //printk(KERN_INFO "mydevice : %i\n", r);
-
-            if ((r == 1 || r == 3) && b != i) {
-                device += (u64)0 << i;
-                // write 0
-                gpio_direction_output(my_gpio, 0);
-                udelay(60);
-                gpio_direction_input(my_gpio);
-                if (r == 3 && b == 0)
-                    b = i; 
-            } else if (r == 2 || b == i) {
-                device += (u64)1 << i;
-                //write 1
-                gpio_direction_output(my_gpio, 0);
-                udelay(15);
-                gpio_direction_input(my_gpio);
-                udelay(45);
-                gpio_direction_input(my_gpio);
-                if (b == i)
-                    b = 0;
-
-                tmp += 1 << (i % 8);
-            } else {
-                printk(KERN_ERR "mydevice : device %i, no device (11) : %i\n", nbDevice, i);
-
-                list_for_each_safe(pos, q, &maListe.liste){
-                    tmpListe = list_entry(pos, struct maStructure, liste);
-                    list_del(pos);
-                    kfree(tmpListe);
-                }
-
-                if (errSearch < MAX_REPEAT_ERR) {
-                    errSearch++;
-                    printk(KERN_INFO "mydevice : restart search rom\n");
-                    mdelay(DELAY_ERR);
-                    return search();
-                } else {
-                    printk(KERN_INFO "mydevice : cannot search rom\n");
-                    return 0;
-                }
-            }
-        }
+    if (list_empty(&bus->maListe.liste))
+        return 0;
 
-        //printk(KERN_INFO "mydevice : crc 0x%x\n", crc);
-        //printk(KERN_INFO "mydevice : tmp 0x%x\n", tmp);
+    pr_debug("mydevice : broadcast conversion\n");
 
-        if (crc != tmp) {
-            printk(KERN_ERR "mydevice : device %i, CRC KO\n", nbDevice);
+    // Wait for the slowest sensor
+    list_for_each_entry(s, &bus->maListe.liste, liste) {
+        if (s->resolution > resolution)
+            resolution = s->resolution;
+    }
 
-            list_for_each_safe(pos, q, &maListe.liste){
-                tmpListe = list_entry(pos, struct maStructure, liste);
-                list_del(pos);
-                kfree(tmpListe);
-            }
+    *start = ktime_get();
+    if ((err = convertStart(bus, 0)))
+        return err;
 
-            if (errSearch < MAX_REPEAT_ERR) {
-                errSearch++;
-                printk(KERN_INFO "mydevice : restart search rom\n");
-                mdelay(DELAY_ERR);
-                return search();
-            } else {
-                errSearch = 0;
-                printk(KERN_INFO "mydevice : cannot search rom\n");
-                return 0;
-            }
-        } else {
-            printk(KERN_INFO "mydevice : device %i, CRC OK\n", nbDevice);
-        }
+    return resolution;
+}
 
-        tmpListe = (struct maStructure *)kmalloc(sizeof(struct maStructure), GFP_KERNEL);
-        tmpListe->minor = nbDevice;
-        tmpListe->device = device;
+// Read one sensor after a conversion, store its sample
+// @return 0 or error
+static int readOut(struct maStructure *s, ktime_t conversion) {
+    u8 scratchpad[9];
+    int resolution;
+    ktime_t start = ktime_get();
+    int err;
 
-        // Add at the end of the list
-        list_add_tail(&tmpListe->liste, &maListe.liste);
+    if ((err = readSensor(s, scratchpad, &resolution))) {
+        printk(KERN_ERR "mydevice : device %i, cannot read scratchpad\n", s->minor);
+        return err;
+    }
+    histAdd(s->stats.transaction, ktime_sub(ktime_get(), start));
+    histAdd(s->stats.conversion, conversion);
+    storeSample(s, scratchpad, resolution);
 
+    return 0;
+}
 
-        nbDevice++;
+// End of a sweep : wait for the conversion, then 0x55 + 0xBE for each sensor
+// (with my_alarm, only for the sensors found by the Alarm Search)
+// The result of each sensor is kept in its error (the error of the conversion for all of them)
+// @return number of sensors read, or the error of the conversion
+static int sweepRead(struct maBus *bus, int resolution, ktime_t start) {
+    struct maStructure *s;
+    int nb = 0;
+    bool alarmOnly;
+    ktime_t conversion;
+    int err;
 
-        n = b;
+    if (!resolution)
+        return 0;
 
-        if (b == 0) {
-            errSearch = 0;
-            return nbDevice;
+    err = resolution < 0 ? resolution : convertWait(bus, 0, resolution, start);
+    if (err) {
+        list_for_each_entry(s, &bus->maListe.liste, liste) {
+            s->error = err;
+            wake_up_interruptible(&s->wait);
         }
-            
+        bus->sweeps++;
+        return err;
     }
-    errSearch = 0;
-    return nbDevice;
-}
-
-// Put the autorisations
-static char *mydevnode(struct device *dev, umode_t *mode)
-{
-    if (mode)
-        *mode = 0666; 
-    return NULL;
-}
+    conversion = ktime_sub(ktime_get(), start);
 
+    // only the sensors in alarm, and the ones never read (all of them if the Alarm Search fails)
+    alarmOnly = my_alarm && alarmSearch(bus) >= 0;
 
+    list_for_each_entry(s, &bus->maListe.liste, liste) {
+        // not in alarm : its last sample is kept
+        s->error = 0;
+        if (alarmOnly && !s->alarm && s->valid)
+            continue;
 
-// Init the char device
-int gpio_init(void)
-{
-    int i = 0;
+        s->error = readOut(s, conversion);
+        if (!s->error)
+            nb++;
+        else
+            wake_up_interruptible(&s->wait); // readers waiting for the first sample
+    }
+    bus->sweeps++;
 
-    nbDevice = 0;
+    return nb;
+}
 
-    printk(KERN_INFO "mydevice : >>> GPIO INIT called\n");
-    printk(KERN_INFO "mydevice : my_gpio : %i\n",my_gpio);
+// Read every sensor of maListe with only one conversion window
+// @return number of sensors read, or the error of the conversion
+static int sweep(struct maBus *bus) {
+    ktime_t start;
+    int resolution = sweepStart(bus, &start);
 
-    // Initialisation 
-    INIT_LIST_HEAD(&maListe.liste);
+    return sweepRead(bus, resolution, start);
+}
 
-    nbDevice = search();
+// Sweep the buses without sampler together : the conversions of all buses are started,
+// then the sensors are read, the slowest bus sets the only conversion window
+// (the buses with a sampler keep the samples of their thread)
+static void sweepAll(void) {
+    int resolution[MAX_BUS];
+    ktime_t start[MAX_BUS];
+    int i;
 
-    if (nbDevice == 0) {
-        printk(KERN_ALERT "mydevice : any device\n");
-        return -ENODEV;
+    for (i = 0; i < nbBus; i++) {
+        if (buses[i].sampler)
+            continue;
+        lockBus(&buses[i]);
+        resolution[i] = sweepStart(&buses[i], &start[i]);
     }
-        
 
-    printk(KERN_INFO "mydevice : >>> nb device : %i \n", nbDevice);
+    for (i = 0; i < nbBus; i++) {
+        if (buses[i].sampler)
+            continue;
+        sweepRead(&buses[i], resolution[i], start[i]);
+        unlockBus(&buses[i]);
+    }
+}
 
+// New sensor of maListe
+static struct maStructure *newSensor(struct maBus *bus, int minor, u64 rom) {
+    struct maStructure *s;
 
-	// Dynamic allocation for (major,minor)
-	if (alloc_chrdev_region(&dev,0,nbDevice,"device_DS18B20_0") == -1)
-	{
-		printk(KERN_ALERT "mydevice : >>> ERROR alloc_chrdev_region\n");
-		return -EINVAL;
-	}
-	// Print out the values
-	//printk(KERN_INFO "mydevice : init allocated (major, minor)=(%d,%d)\n",MAJOR(dev),0);
+    s = kzalloc(sizeof(struct maStructure), GFP_KERNEL);
+    if (!s)
+        return NULL;
 
-    for(i=1;i<nbDevice;i++) {
-        if (register_chrdev_region(MAJOR(dev), i, "device_DS18B20_" + (char)i) == -1)
-        {
-            printk(KERN_ALERT ">>> ERROR alloc_chrdev_region\n");
-            return -EINVAL;
-        }
-        // Print out the values
-	    //printk(KERN_INFO "mydevice : init allocated (major, minor)=(%d,%d)\n",MAJOR(dev),i);
+    s->ring = kcalloc(my_buffer, sizeof(struct ds18b20_sample), GFP_KERNEL);
+    if (!s->ring) {
+        kfree(s);
+        return NULL;
     }
 
-	// Structures allocation
-	my_cdev = cdev_alloc();
-	my_cdev->ops = &fops;
-	my_cdev->owner = THIS_MODULE;
-	// linking operations to device
-	cdev_add(my_cdev,dev,nbDevice);
-
-    /* Create peripheral class */
-    myClass = class_create(THIS_MODULE, "myDevice");
-    myClass->devnode = mydevnode;
+    s->bus = bus;
+    s->minor = minor;
+    s->device = rom;
+    s->resolution = 12; // unknown, wait for the longest conversion
+    s->valid = false;
+    kref_init(&s->ref);
+    init_waitqueue_head(&s->wait);
+    mutex_init(&s->sampleLock);
 
-    for (i=0;i<nbDevice;i++) {
-        device_create(myClass, NULL, MKDEV(MAJOR(dev), i), NULL, "/myDevice/device_DS18B20_%i", i);
-        printk(KERN_INFO "mydevice : device %i in /dev/myDevice/device_DS18B20_%i\n", i, i);
-    }
-    
+    return s;
+}
 
-    if (!gpio_is_valid(my_gpio)){
-        printk(KERN_ERR "mydevice: invalid GPIO\n");
-        return -ENODEV;
-    }
+// Print a latency histogram, bucket n : [2^n, 2^(n+1)) us
+static void printHist(struct seq_file *m, const char *name, const u32 *hist) {
+    int i;
 
-    if (gpio_request(my_gpio, MY_DEVICE) < 0) {
-        printk(KERN_ALERT "mydevice : error gpio_request\n");
-        return -1;
-    }
+    seq_printf(m, "%s", name);
+    for (i = 0; i < HIST_BUCKETS; i++)
+        seq_printf(m, " %u", hist[i]);
+    seq_putc(m, '\n');
+}
 
-    printk(KERN_INFO "mydevice : >>> end GPIO EXIT called\n");
+// /sys/kernel/debug/ds18b20/device_DS18B20_<MINOR>
+static int sensorStats_show(struct seq_file *m, void *v) {
+    struct maStructure *s = m->private;
+    s64 age = -1;
 
-	return(0);
+    if (s->stats.lastRead)
+        age = div_s64(ktime_get_ns() - s->stats.lastRead, NSEC_PER_MSEC);
+
+    seq_printf(m, "rom %016llx\nbus %i\nresolution %i\n", s->device, s->bus->id, s->resolution);
+    seq_printf(m, "reads %u\ncrc_errors %u\nretries %u\nresolution_errors %u\n",
+        s->stats.reads, s->stats.crcErrors, s->stats.retries, s->stats.resolutionErrors);
+    seq_printf(m, "last_read_ns %lld\nlast_read_age_ms %lld\n", s->stats.lastRead, age);
+    printHist(m, "conversion_us", s->stats.conversion);
+    printHist(m, "transaction_us", s->stats.transaction);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sensorStats);
+
+// /sys/kernel/debug/ds18b20/bus<N>
+static int busStats_show(struct seq_file *m, void *v) {
+    struct maBus *bus = m->private;
+
+    seq_printf(m, "backend %s\ndevices %i\n", bus->ops->name, bus->nbDevice);
+    seq_printf(m, "resets %u\nno_presence %u\nslot_timeouts %u\nsearch_restarts %u\ntimeouts %u\nbusy_ns %lld\nsearch_us %lld\n",
+        bus->stats.resets, bus->stats.noPresence, bus->stats.slotTimeouts, bus->stats.searchRestarts, bus->stats.timeouts, bus->stats.busy,
+        ktime_to_us(bus->searchTime));
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(busStats);
+
+// debugfs file of the stats of a sensor
+static void debugSensor(struct maStructure *s) {
+    char name[32];
+
+    snprintf(name, sizeof(name), "device_DS18B20_%i", s->minor);
+    s->debug = debugfs_create_file(name, 0444, debugDir, s, &sensorStats_fops);
+}
+
+// Free a sensor when the list and the last open file have released it
+static void freeSensor(struct kref *ref) {
+    struct maStructure *s = container_of(ref, struct maStructure, ref);
+
+    kfree(s->ring);
+    kfree(s);
+}
+
+// Minor for a ROM : its former minor, else a minor never used, else any free minor
+// @return minor or -ENOSPC
+static int allocMinor(u64 rom) {
+    int i;
+    int unused = -1, free = -1;
+
+    for (i = 0; i < MAX_DEVICE; i++) {
+        if (minors[i])
+            continue;
+        if (minorRom[i] == rom)
+            return i;
+        if (unused < 0 && minorRom[i] == 0)
+            unused = i;
+        if (free < 0)
+            free = i;
+    }
+
+    if (unused >= 0)
+        return unused;
+    if (free >= 0)
+        return free;
+    return -ENOSPC;
+}
+
+// Add a sensor found on a bus : minor, maListe, shared memory slot and node (once the class exists)
+static struct maStructure *plugSensor(struct maBus *bus, u64 rom) {
+    struct maStructure *s;
+    int minor;
+
+    mutex_lock(&sensorsLock);
+
+    minor = allocMinor(rom);
+    if (minor < 0) {
+        mutex_unlock(&sensorsLock);
+        printk(KERN_ERR "mydevice : more than %i devices\n", MAX_DEVICE);
+        return NULL;
+    }
+
+    s = newSensor(bus, minor, rom);
+    if (!s) {
+        mutex_unlock(&sensorsLock);
+        return NULL;
+    }
+
+    minors[minor] = s;
+    minorRom[minor] = rom;
+    list_add_tail(&s->liste, &bus->maListe.liste);
+    bus->nbDevice++;
+    nbDevice++;
+
+    mutex_unlock(&sensorsLock);
+
+    if (shm) {
+        shm->slots[minor].minor = minor;
+        shm->slots[minor].rom = rom;
+    }
+
+    if (myClass) {
+        device_create(myClass, NULL, MKDEV(MAJOR(dev), minor), NULL, "/myDevice/device_DS18B20_%i", minor);
+        printk(KERN_INFO "mydevice : device %i in /dev/myDevice/device_DS18B20_%i\n", minor, minor);
+    }
+
+    if (debugDir)
+        debugSensor(s);
+
+    return s;
+}
+
+// Remove an unplugged sensor (bus lock held) : its node is deleted, the open files get -ENODEV
+static void unplugSensor(struct maStructure *s) {
+    struct maBus *bus = s->bus;
+
+    mutex_lock(&sensorsLock);
+    list_del(&s->liste);
+    minors[s->minor] = NULL;
+    bus->nbDevice--;
+    nbDevice--;
+    s->removed = true;
+    mutex_unlock(&sensorsLock);
+
+    if (shm)
+        shm->slots[s->minor].rom = 0;
+
+    device_destroy(myClass, MKDEV(MAJOR(dev), s->minor));
+    debugfs_remove(s->debug);
+    printk(KERN_INFO "mydevice : device %i removed\n", s->minor);
+
+    wake_up_interruptible(&s->wait);
+
+    kref_put(&s->ref, freeSensor);
+}
+
+// Free every sensor of maListe
+static void freeListe(struct maBus *bus) {
+    struct maStructure *s, *next;
+
+    list_for_each_entry_safe(s, next, &bus->maListe.liste, liste) {
+        list_del(&s->liste);
+        minors[s->minor] = NULL;
+        debugfs_remove(s->debug);
+        kref_put(&s->ref, freeSensor);
+    }
+}
+
+// Free the sensors and the backend of the n first buses
+static void freeBuses(int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        freeListe(&buses[i]);
+        buses[i].ops->release(&buses[i]);
+    }
+}
+
+// Sensor of a minor, NULL if unknown (sensorsLock held)
+static struct maStructure *findSensor(int minor) {
+    if (minor < 0 || minor >= MAX_DEVICE)
+        return NULL;
+
+    return minors[minor];
+}
+
+// Background thread of a bus : sweep every sensor of the bus each my_interval ms,
+// and search the bus again each my_rescan ms
+static int samplerThread(void *data) {
+    struct maBus *bus = data;
+    unsigned long nextRescan = jiffies + msecs_to_jiffies(my_rescan);
+
+    printk(KERN_INFO "mydevice : bus %i, sampler started (%i ms)\n", bus->id, my_interval);
+
+    while (!kthread_should_stop()) {
+        if (my_rescan > 0 && time_after_eq(jiffies, nextRescan)) {
+            rescanBus(bus);
+            nextRescan = jiffies + msecs_to_jiffies(my_rescan);
+        }
+
+        lockBus(bus);
+        sweep(bus);
+        unlockBus(bus);
+
+        // woken up early by kthread_stop()
+        schedule_timeout_interruptible(msecs_to_jiffies(my_interval));
+    }
+
+    printk(KERN_INFO "mydevice : bus %i, sampler stopped\n", bus->id);
+    return 0;
+}
+
+// Convert and read one sensor
+// @return 0 or error
+static int acquire(struct maStructure *s) {
+    struct maBus *bus = s->bus;
+    u8 scratchpad[9];
+    int resolution;
+    int err;
+    ktime_t start;
+
+    // The bus is kept during the conversion : the read slots tell its end only right after Convert T,
+    // with no other transaction between them (the reset of convertStart() clears bus->fault)
+    lockBus(bus);
+
+    start = ktime_get();
+    err = convert(bus, s->device, s->resolution);
+
+    if (!err) {
+        histAdd(s->stats.conversion, ktime_sub(ktime_get(), start));
+
+        start = ktime_get();
+        err = readSensor(s, scratchpad, &resolution);
+        if (!err)
+            histAdd(s->stats.transaction, ktime_sub(ktime_get(), start));
+    }
+
+    if (err)
+        s->error = err;
+
+    unlockBus(bus);
+
+    if (err)
+        return err;
+
+    storeSample(s, scratchpad, resolution);
+
+    return 0;
+}
+
+// Copy the samples kept since the file offset (offset = number of samples * sizeof(struct ds18b20_sample))
+// The samples lost (buffer overwritten) are skipped, 0 when there is no new sample
+static ssize_t readHistory(struct file *f, char *buf, size_t size, loff_t *offset) {
+    struct maSession *session = f->private_data;
+    struct maStructure *s = session->sensor;
+    u32 next, last, oldest;
+    size_t len = 0;
+
+    if (size < sizeof(struct ds18b20_sample))
+        return -EINVAL;
+
+    mutex_lock(&s->sampleLock);
+
+    next = *offset / sizeof(struct ds18b20_sample);
+    last = s->sample.seq;
+    oldest = last > my_buffer ? last - my_buffer : 0;
+
+    if (next < oldest) {
+        printk(KERN_INFO "mydevice : device %i, %u samples lost\n", s->minor, oldest - next);
+        next = oldest;
+    }
+
+    while (next < last && len + sizeof(struct ds18b20_sample) <= size) {
+        if (copy_to_user(buf + len, &s->ring[next % my_buffer], sizeof(struct ds18b20_sample)))
+            break;
+        len += sizeof(struct ds18b20_sample);
+        next++;
+    }
+
+    mutex_unlock(&s->sampleLock);
+
+    if (len == 0 && next < last)
+        return -EFAULT;
+
+    *offset = (loff_t)next * sizeof(struct ds18b20_sample);
+
+    return len;
+}
+
+// read of temperature (DS18B20)
+// text : one line then end of file, binary : one struct ds18b20_sample per read
+static ssize_t gpio_read(struct file *f, char *buf, size_t size, loff_t *offset) {
+    struct maSession *session = f->private_data;
+    struct maStructure *s = session->sensor;
+    struct maBus *bus = s->bus;
+    struct ds18b20_sample sample;
+    char text[16];
+    int len;
+    int err;
+    u32 sweeps;
+
+    pr_debug("mydevice : >>> GPIO READ called\n");
+
+    if (s->removed)
+        return -ENODEV;
+
+    if (session->format == DS18B20_FORMAT_STREAM)
+        return readHistory(f, buf, size, offset);
+
+    if (session->format == DS18B20_FORMAT_TEXT && *offset > 0)
+        return 0;
+
+    if (session->format == DS18B20_FORMAT_BINARY && size < sizeof(sample))
+        return -EINVAL;
+
+    if (bus->sampler) {
+        // Last sample of the background thread, the bus is not used
+        // before the first sweep : wait for it (or -EAGAIN with O_NONBLOCK)
+        if (!s->valid && !s->error) {
+            if (f->f_flags & O_NONBLOCK)
+                return -EAGAIN;
+            if (wait_event_interruptible(s->wait, s->valid || s->error || s->removed))
+                return -ERESTARTSYS;
+            if (s->removed)
+                return -ENODEV;
+        }
+        // the last sweep failed for this sensor : no stale sample
+        if ((err = READ_ONCE(s->error)))
+            return err;
+    } else if (my_broadcast) {
+        // All sensors of the bus in one conversion window, a sweep finished while waiting
+        // for the lock already read this sensor (N readers : one sweep, not N)
+        sweeps = READ_ONCE(bus->sweeps);
+        lockBus(bus);
+        if (bus->sweeps == sweeps)
+            sweep(bus);
+        err = s->error;
+        unlockBus(bus);
+        if (err)
+            return err;
+        if (!s->valid)
+            return -EBADE;
+    } else {
+        if ((err = acquire(s)))
+            return err;
+    }
+
+    mutex_lock(&s->sampleLock);
+    sample = s->sample;
+    mutex_unlock(&s->sampleLock);
+    session->seen = sample.seq;
+
+    printTemperature(s);
+
+    if (session->format == DS18B20_FORMAT_BINARY) {
+        if (copy_to_user(buf, &sample, sizeof(sample)))
+            return -EFAULT;
+        return sizeof(sample);
+    }
+
+    len = formatSample(text, sizeof(text), &sample);
+    len = min_t(int, len, size);
+
+    if (copy_to_user(buf, text, len))
+        return -EFAULT;
+
+    *offset += len;
+
+    return len;
+}
+
+// Map the shared memory (read only)
+static int gpio_mmap(struct file *f, struct vm_area_struct *vma) {
+    if (!shm)
+        return -ENODEV;
+
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > shmSize)
+        return -EINVAL;
+
+    vma->vm_flags &= ~VM_MAYWRITE;
+
+    return remap_vmalloc_range(vma, shm, 0);
+}
+
+// Allocate the shared memory, one slot per sensor
+static int shmInit(void) {
+    struct maStructure *s;
+    int i;
+
+    shmSize = PAGE_ALIGN(sizeof(struct ds18b20_shm) + MAX_DEVICE * sizeof(struct ds18b20_shm_slot));
+
+    // zeroed, page aligned, can be mapped
+    shm = vmalloc_user(shmSize);
+    if (!shm)
+        return -ENOMEM;
+
+    shm->magic = DS18B20_SHM_MAGIC;
+    shm->count = MAX_DEVICE;
+    shm->slot_size = sizeof(struct ds18b20_shm_slot);
+
+    for (i = 0; i < nbBus; i++) {
+        list_for_each_entry(s, &buses[i].maListe.liste, liste) {
+            shm->slots[s->minor].minor = s->minor;
+            shm->slots[s->minor].rom = s->device;
+        }
+    }
+
+    return 0;
+}
+
+// Readable when a sample has not been read yet
+// Without the sampler, a read always converts : always readable
+static __poll_t gpio_poll(struct file *f, poll_table *wait) {
+    struct maSession *session = f->private_data;
+    struct maStructure *s = session->sensor;
+    u32 seen;
+
+    poll_wait(f, &s->wait, wait);
+
+    if (s->removed)
+        return POLLERR | POLLHUP;
+
+    if (!s->bus->sampler)
+        return POLLIN | POLLRDNORM;
+
+    if (session->format == DS18B20_FORMAT_STREAM)
+        seen = f->f_pos / sizeof(struct ds18b20_sample);
+    else
+        seen = session->seen;
+
+    if (READ_ONCE(s->sample.seq) != seen)
+        return POLLIN | POLLRDNORM;
+
+    return 0;
+}
+
+// Configuration of the open file
+static long gpio_ioctl(struct file *f, unsigned int cmd, unsigned long arg) {
+    struct maSession *session = f->private_data;
+    struct maStructure *s = session->sensor;
+    struct ds18b20_alarm alarm;
+    int format;
+
+    switch (cmd) {
+    case DS18B20_IOC_SET_FORMAT:
+        if (get_user(format, (int __user *)arg))
+            return -EFAULT;
+        if (format != DS18B20_FORMAT_TEXT && format != DS18B20_FORMAT_BINARY && format != DS18B20_FORMAT_STREAM)
+            return -EINVAL;
+        session->format = format;
+        f->f_pos = 0;
+        return 0;
+
+    case DS18B20_IOC_GET_FORMAT:
+        return put_user(session->format, (int __user *)arg);
+
+    case DS18B20_IOC_SET_ALARM:
+        if (copy_from_user(&alarm, (void __user *)arg, sizeof(alarm)))
+            return -EFAULT;
+        if (alarm.low < -55 || alarm.high > 125 || alarm.low > alarm.high)
+            return -EINVAL;
+        return writeConfig(s, alarm.high, alarm.low, s->resolution);
+
+    case DS18B20_IOC_GET_ALARM:
+        alarm.high = s->th;
+        alarm.low = s->tl;
+        if (copy_to_user((void __user *)arg, &alarm, sizeof(alarm)))
+            return -EFAULT;
+        return 0;
+    }
+
+    return -ENOTTY;
+}
+
+// Change resolution of DS18B20
+static ssize_t gpio_write(struct file *f, const char *buf, size_t size, loff_t *offset) {
+    int err;
+
+    struct maSession *session = f->private_data;
+    struct maStructure *s = session->sensor;
+    int value;
+
+    pr_debug("mydevice : >>> GPIO WRITE called\n");
+
+    if ( (err = kstrtoint_from_user(buf, size, 10, &value)) ) {
+        printk(KERN_ERR "mydevice : Error conversion : %i\n", err);
+        return err;
+    }
+
+    pr_debug("mydevice : value %i\n", value);
+
+    if (value < 9 || value > 12) {
+        printk(KERN_ERR "mydevice : Error value\n");
+        return -EINVAL;
+    }
+
+    err = writeConfig(s, s->th, s->tl, value);
+    if (err)
+        return err;
+
+    return size;
+}
+
+// Snapshot of /dev/myDevice/all, made again by each read at offset 0
+struct maSnapshot{
+    size_t len;
+    char text[MAX_DEVICE * ALL_LINE];
+};
+
+// One line for each sensor : "<minor> <rom> <temperature>", "-" when it has no sample,
+// "E<errno>" when its last read failed (no stale temperature)
+static size_t snapshot(char *text) {
+    struct maStructure *s;
+    struct ds18b20_sample sample;
+    size_t len = 0;
+    int i;
+    int err;
+
+    mutex_lock(&sensorsLock);
+    for (i = 0; i < MAX_DEVICE; i++) {
+        s = minors[i];
+        if (!s)
+            continue;
+
+        len += scnprintf(text + len, ALL_LINE, "%i %016llx ", i, s->device);
+
+        err = READ_ONCE(s->error);
+        if (err) {
+            len += scnprintf(text + len, ALL_LINE, "E%i\n", -err);
+            continue;
+        }
+
+        if (!s->valid) {
+            len += scnprintf(text + len, ALL_LINE, "-\n");
+            continue;
+        }
+
+        mutex_lock(&s->sampleLock);
+        sample = s->sample;
+        mutex_unlock(&s->sampleLock);
+
+        len += formatSample(text + len, ALL_LINE, &sample);
+    }
+    mutex_unlock(&sensorsLock);
+
+    return len;
+}
+
+// read of /dev/myDevice/all : every sensor after one sweep of all buses, then end of file
+// (pread at offset 0 for the next snapshot)
+static ssize_t allRead(struct file *f, char *buf, size_t size, loff_t *offset) {
+    struct maSnapshot *snap = f->private_data;
+
+    if (*offset == 0) {
+        sweepAll();
+        snap->len = snapshot(snap->text);
+    }
+
+    return simple_read_from_buffer(buf, size, offset, snap->text, snap->len);
+}
+
+static int allRelease(struct inode *in, struct file *f) {
+    kfree(f->private_data);
+    return 0;
+}
+
+// Sensor of a batch entry, by ROM or by minor (rom 0), held with a reference
+static struct maStructure *batchSensor(const struct ds18b20_entry *entry) {
+    struct maStructure *s = NULL;
+    int i;
+
+    mutex_lock(&sensorsLock);
+    if (entry->rom) {
+        for (i = 0; i < MAX_DEVICE && !s; i++) {
+            if (minors[i] && minors[i]->device == entry->rom)
+                s = minors[i];
+        }
+    } else {
+        s = findSensor(entry->minor);
+    }
+    if (s)
+        kref_get(&s->ref);
+    mutex_unlock(&sensorsLock);
+
+    return s;
+}
+
+// Convert and read the sensors of a batch, the samples in the entries
+// The conversions of all buses are started, then the sensors are read : one conversion window,
+// a broadcast conversion on a bus with several sensors in the batch
+// (the buses with a sampler keep the samples of their thread)
+static void readBatch(struct maStructure **sensors, struct ds18b20_entry *entries, int count) {
+    int resolution[MAX_BUS] = { 0 };
+    int nb[MAX_BUS] = { 0 };
+    int started[MAX_BUS]; // error of the start of the conversion
+    u64 rom[MAX_BUS];
+    ktime_t start[MAX_BUS], conversion;
+    struct maStructure *s;
+    int i, j, err;
+
+    for (j = 0; j < count; j++) {
+        s = sensors[j];
+        if (!s || s->bus->sampler)
+            continue;
+        i = s->bus->id;
+        nb[i]++;
+        rom[i] = s->device;
+        if (s->resolution > resolution[i])
+            resolution[i] = s->resolution;
+    }
+
+    for (i = 0; i < nbBus; i++) {
+        if (!nb[i])
+            continue;
+        if (nb[i] > 1)
+            rom[i] = 0;
+        lockBus(&buses[i]);
+        start[i] = ktime_get();
+        started[i] = convertStart(&buses[i], rom[i]);
+    }
+
+    for (i = 0; i < nbBus; i++) {
+        if (!nb[i])
+            continue;
+
+        err = started[i] ? started[i] : convertWait(&buses[i], rom[i], resolution[i], start[i]);
+        conversion = ktime_sub(ktime_get(), start[i]);
+
+        for (j = 0; j < count; j++) {
+            s = sensors[j];
+            if (s && s->bus == &buses[i] && !s->removed)
+                entries[j].status = s->error = err ? err : readOut(s, conversion);
+        }
+
+        unlockBus(&buses[i]);
+    }
+
+    for (j = 0; j < count; j++) {
+        s = sensors[j];
+        if (!s || entries[j].status)
+            continue;
+        if (s->removed) {
+            entries[j].status = -ENODEV;
+            continue;
+        }
+        if (!s->valid) {
+            entries[j].status = -EAGAIN;
+            continue;
+        }
+        mutex_lock(&s->sampleLock);
+        entries[j].sample = s->sample;
+        mutex_unlock(&s->sampleLock);
+    }
+}
+
+// The batch holds every sensor of the bus, and they share TH and TL : one Skip ROM 0x4E writes all of them
+static bool batchHoldsBus(struct maBus *bus, struct maStructure **sensors, int count) {
+    struct maStructure *s, *first;
+    int j;
+
+    if (list_empty(&bus->maListe.liste))
+        return false;
+
+    first = list_first_entry(&bus->maListe.liste, struct maStructure, liste);
+
+    list_for_each_entry(s, &bus->maListe.liste, liste) {
+        if (s->th != first->th || s->tl != first->tl)
+            return false;
+
+        for (j = 0; j < count && sensors[j] != s; j++)
+            ;
+        if (j == count)
+            return false;
+    }
+
+    return true;
+}
+
+// Sensor of the batch to write on this bus
+static bool batchWrites(const struct maStructure *s, const struct maBus *bus, int resolution) {
+    return s && s->bus == bus && !s->removed && !unchanged(s, s->th, s->tl, resolution);
+}
+
+// Write the resolution of the sensors of a batch (TH and TL kept), check it with a read of each scratchpad
+// Skip ROM 0x4E when the batch holds the whole bus, else 0x55 + 0x4E for each sensor of the bus,
+// the sensors already at this resolution are not written, a sensor not configured is written again alone (writeConfig)
+// With my_eeprom, Copy Scratchpad of the sensors configured (Skip ROM when the whole bus is)
+static void configBatch(struct maStructure **sensors, struct ds18b20_entry *entries, int count, int resolution) {
+    struct maBus *bus;
+    struct maStructure *s;
+    u8 scratchpad[9];
+    bool written[MAX_DEVICE] = { false };
+    bool retry[MAX_DEVICE] = { false };
+    bool any, all;
+    int i, j;
+
+    for (i = 0; i < nbBus; i++) {
+        bus = &buses[i];
+
+        for (j = 0, any = false; j < count && !any; j++)
+            any = batchWrites(sensors[j], bus, resolution);
+        if (!any)
+            continue;
+
+        lockBus(bus);
+
+        all = batchHoldsBus(bus, sensors, count);
+        if (all) {
+            s = list_first_entry(&bus->maListe.liste, struct maStructure, liste);
+            writeScratchpad(bus, 0, s->th, s->tl, resolution);
+        }
+
+        for (j = 0; j < count; j++) {
+            s = sensors[j];
+            if (all ? s && s->bus == bus : batchWrites(s, bus, resolution)) {
+                if (!all)
+                    writeScratchpad(bus, s->device, s->th, s->tl, resolution);
+                written[j] = true;
+            }
+        }
+
+        // check up
+        for (j = 0; j < count; j++) {
+            s = sensors[j];
+            if (!written[j] || s->bus != bus)
+                continue;
+            if (!readScratchpad(s, scratchpad) && configured(scratchpad, s->th, s->tl, resolution)) {
+                s->resolution = resolution;
+                s->configKnown = true;
+                continue;
+            }
+            s->stats.resolutionErrors++;
+            written[j] = false;
+            retry[j] = true;
+            all = false;
+        }
+
+        for (j = 0; j < count && my_eeprom; j++) {
+            if (all) {
+                copyScratchpad(bus, 0);
+                break;
+            }
+            if (written[j] && sensors[j]->bus == bus)
+                copyScratchpad(bus, sensors[j]->device);
+        }
+
+        unlockBus(bus);
+    }
+
+    for (j = 0; j < count; j++) {
+        s = sensors[j];
+        if (!s)
+            continue;
+        if (s->removed)
+            entries[j].status = -ENODEV;
+        else if (retry[j])
+            entries[j].status = writeConfig(s, s->th, s->tl, resolution);
+    }
+}
+
+// Batches of /dev/myDevice/all : DS18B20_IOC_READ_BATCH and DS18B20_IOC_SET_RESOLUTION_BATCH
+static long allIoctl(struct file *f, unsigned int cmd, unsigned long arg) {
+    struct ds18b20_batch batch;
+    struct ds18b20_entry *entries;
+    struct maStructure **sensors;
+    long err = 0;
+    int j;
+
+    if (cmd != DS18B20_IOC_READ_BATCH && cmd != DS18B20_IOC_SET_RESOLUTION_BATCH)
+        return -ENOTTY;
+
+    if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+        return -EFAULT;
+
+    if (batch.count == 0 || batch.count > MAX_DEVICE)
+        return -EINVAL;
+
+    if (cmd == DS18B20_IOC_SET_RESOLUTION_BATCH && (batch.resolution < 9 || batch.resolution > 12))
+        return -EINVAL;
+
+    entries = kcalloc(batch.count, sizeof(*entries), GFP_KERNEL);
+    sensors = kcalloc(batch.count, sizeof(*sensors), GFP_KERNEL);
+    if (!entries || !sensors) {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    if (copy_from_user(entries, u64_to_user_ptr(batch.entries), batch.count * sizeof(*entries))) {
+        err = -EFAULT;
+        goto out;
+    }
+
+    for (j = 0; j < batch.count; j++) {
+        sensors[j] = batchSensor(&entries[j]);
+        memset(&entries[j].sample, 0, sizeof(entries[j].sample));
+        entries[j].status = sensors[j] ? 0 : -ENODEV;
+        if (sensors[j]) {
+            entries[j].rom = sensors[j]->device;
+            entries[j].minor = sensors[j]->minor;
+        }
+    }
+
+    if (cmd == DS18B20_IOC_READ_BATCH)
+        readBatch(sensors, entries, batch.count);
+    else
+        configBatch(sensors, entries, batch.count, batch.resolution);
+
+    if (copy_to_user(u64_to_user_ptr(batch.entries), entries, batch.count * sizeof(*entries)))
+        err = -EFAULT;
+
+out:
+    for (j = 0; sensors && j < batch.count; j++) {
+        if (sensors[j])
+            kref_put(&sensors[j]->ref, freeSensor);
+    }
+    kfree(sensors);
+    kfree(entries);
+
+    return err;
+}
+
+static const struct file_operations allFops =
+{
+  .read = allRead,
+  .release = allRelease,
+  .unlocked_ioctl = allIoctl,
+  .compat_ioctl = compat_ptr_ioctl, // the batches hold their pointer in a __u64
+};
+
+// Open of /dev/myDevice/all, its file gets allFops
+static int allOpen(struct inode *in, struct file *f) {
+    f->private_data = kzalloc(sizeof(struct maSnapshot), GFP_KERNEL);
+    if (!f->private_data)
+        return -ENOMEM;
+
+    replace_fops(f, &allFops);
+
+    return 0;
+}
+
+// When open device
+static int gpio_open(struct inode *in, struct file *f) {
+    struct maSession *session;
+    
+    pr_debug("mydevice : >>> GPIO OPEN called\n");
+
+    if (iminor(in) == ALL_MINOR)
+        return allOpen(in, f);
+
+    session = kzalloc(sizeof(struct maSession), GFP_KERNEL);
+    if (!session)
+        return -ENOMEM;
+    session->format = DS18B20_FORMAT_TEXT;
+
+    mutex_lock(&sensorsLock);
+    session->sensor = findSensor(iminor(in));
+    if (session->sensor)
+        kref_get(&session->sensor->ref);
+    mutex_unlock(&sensorsLock);
+
+    if (!session->sensor) {
+        kfree(session);
+        return -ENODEV;
+    }
+
+    f->private_data = session;
+
+    return 0;
+}
+
+// When close device
+static int gpio_release(struct inode *in, struct file *f) {
+    struct maSession *session = f->private_data;
+
+    pr_debug("mydevice : >>> GPIO RELEASE called\n");
+
+    kref_put(&session->sensor->ref, freeSensor);
+    kfree(session);
+
+    return 0;
+}
+
+
+// Send one byte
+static int send(struct maBus *bus, unsigned char n) {
+    trace_ds18b20_command(bus->id, n);
+
+    writeSlots(bus, &n, 1);
+
+    return 0;
+}
+
+// Send 8 bytes (for rom device), least significant byte first
+static int sendRom(struct maBus *bus, u64 device) {
+    u8 rom[8];
+    int i;
+
+    trace_ds18b20_select(bus->id, device);
+
+    for (i = 0; i < 8; i++)
+        rom[i] = device >> (8 * i);
+
+    writeSlots(bus, rom, 8);
+
+    return 0;
+}
+
+// Read n bytes, least significant bit first
+// only the slots in the loop, the caller checks the CRC on the whole buffer
+static void readBytes(struct maBus *bus, u8 *data, int n) {
+    int i, j;
+    u8 byte;
+
+    for (i = 0; i < n; i++) {
+        byte = 0;
+        for (j = 0; j < 8; j++)
+            byte |= readBit(bus) << j;
+        data[i] = byte;
+    }
+
+    trace_ds18b20_read(bus->id, data, n);
+}
+
+// Write n bytes (data of a function command)
+static void writeBytes(struct maBus *bus, const u8 *data, int n) {
+    trace_ds18b20_write(bus->id, data, n);
+
+    writeSlots(bus, data, n);
+}
+
+// Write n bytes, least significant bit first
+static void writeSlots(struct maBus *bus, const u8 *data, int n) {
+    int i, j;
+
+    for (i = 0; i < n; i++)
+        for (j = 0; j < 8; j++)
+            writeBit(bus, (data[i] >> j) & 1);
+}
+
+// Dallas CRC-8 of n bytes, one table lookup per byte
+// the CRC of a ROM (7 bytes) or a scratchpad (8 bytes) is the next byte
+static u8 crc8(const u8 *data, int n) {
+    u8 crc = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        crc = crc8_table[crc ^ data[i]];
+
+    return crc;
+}
+
+// Read one bit (read slot)
+// After a bus fault, no more slot until the next reset : the bus is read as released
+static int readBit(struct maBus *bus) {
+    int bit;
+
+    if (bus->fault)
+        return 1;
+
+    bit = bus->ops->readBit(bus);
+    if (bit < 0) {
+        printk(KERN_ERR "mydevice : bus %i, bus held low after a read slot\n", bus->id);
+        bus->stats.slotTimeouts++;
+        bus->fault = bit;
+        return 1;
+    }
+
+    return bit;
+}
+
+// Write one bit (write slot)
+static void writeBit(struct maBus *bus, int bit) {
+    bus->ops->writeBit(bus, bit);
+}
+
+// Search ROM step : read the bit and its complement, write the direction
+// direction is used when the devices disagree (bit and complement 0)
+// @return bit 0 : bit, bit 1 : complement, bit 2 : direction written
+static int triplet(struct maBus *bus, int direction) {
+    int id, cmp;
+
+    if (bus->ops->triplet)
+        return bus->ops->triplet(bus, direction);
+
+    id = readBit(bus);
+    cmp = readBit(bus);
+
+    if (id != cmp)
+        direction = id;
+    else if (id)
+        direction = 1; // no device
+
+    writeBit(bus, direction);
+
+    return id | (cmp << 1) | (direction << 2);
+}
+
+// Reset of 1wire : the sensors answer with a presence pulse
+// @return 0, -ENXIO when no sensor answers, -EIO when the bus is held low (short)
+static int reset(struct maBus *bus) {
+    int err;
+
+    bus->fault = 0;
+    err = bus->ops->reset(bus);
+
+    trace_ds18b20_reset(bus->id, err);
+
+    bus->stats.resets++;
+    if (err) {
+        bus->stats.noPresence++;
+        pr_debug("mydevice : bus %i, no presence pulse (%i)\n", bus->id, err);
+    }
+
+    return err;
+}
+
+
+// GPIO backend : 1-Wire bit-banged on bus->gpio
+
+static int gpioInit(struct maBus *bus) {
+    if (!gpio_is_valid(bus->gpio)){
+        printk(KERN_ERR "mydevice: invalid GPIO\n");
+        return -ENODEV;
+    }
+
+    if (gpio_request(bus->gpio, MY_DEVICE) < 0) {
+        printk(KERN_ALERT "mydevice : error gpio_request\n");
+        return -EBUSY;
+    }
+
+    // released (pull-up) : the pin may be left as an output low by its previous user
+    gpio_direction_input(bus->gpio);
+
+    return 0;
+}
+
+static void gpioRelease(struct maBus *bus) {
+    //gpio_unexport(bus->gpio);
+    gpio_free(bus->gpio);
+}
+
+// Reset pulse (480 us low), then the presence pulse of the sensors sampled 70 us after the release
+static int gpioReset(struct maBus *bus) {
+    int presence;
+
+    // held low before the reset : short
+    if (gpio_get_value(bus->gpio) != 1)
+        return -EIO;
+
+    gpio_direction_output(bus->gpio, 0);
+    udelay(480);
+    gpio_direction_input(bus->gpio);
+    udelay(70);
+    presence = !gpio_get_value(bus->gpio);
+    udelay(410);
+
+    // still low after the presence pulse : short
+    if (gpio_get_value(bus->gpio) != 1)
+        return -EIO;
+
+    return presence ? 0 : -ENXIO;
+}
+
+static void gpioWriteBit(struct maBus *bus, int bit) {
+    if (bit) {
+        gpio_direction_output(bus->gpio, 0);
+        udelay(15);
+        gpio_direction_input(bus->gpio);
+        udelay(45);
+    } else {
+        gpio_direction_output(bus->gpio, 0);
+        udelay(60);
+        gpio_direction_input(bus->gpio);
+    }
+}
+
+// Wait for the bus going high, at most SLOT_TIMEOUT us
+// @return 0 or -EIO (bus held low)
+static int gpioWaitHigh(struct maBus *bus) {
+    int us;
+
+    for (us = 0; gpio_get_value(bus->gpio) != 1; us++) {
+        if (us >= SLOT_TIMEOUT)
+            return -EIO;
+        udelay(1);
+    }
+
+    return 0;
+}
+
+static int gpioReadBit(struct maBus *bus) {
+    int val;
+
+    gpio_direction_output(bus->gpio, 0);
+    udelay(1);
+    gpio_direction_input(bus->gpio);
+    udelay(5);
+    val = gpio_get_value(bus->gpio);
+    udelay(DELAY_READ);
+
+    if (gpioWaitHigh(bus))
+        return -EIO;
+
+    return val;
+}
+
+static const struct maBusOps gpioOps = {
+    .name = "gpio",
+    .init = gpioInit,
+    .release = gpioRelease,
+    .reset = gpioReset,
+    .writeBit = gpioWriteBit,
+    .readBit = gpioReadBit,
+};
+
+
+// Simulated backend : DS18B20 sensors modelled in memory, no GPIO
+// ROM IDs, scratchpads, conversion time of the resolution and bit errors (my_sim_error)
+
+static int simInit(struct maBus *bus) {
+    struct maSim *sim;
+    struct maSimSensor *d;
+    u8 rom[8];
+    int i, k;
+
+    if (my_sim_sensors < 0 || my_sim_sensors > SIM_MAX_SENSORS) {
+        printk(KERN_ERR "mydevice : invalid my_sim_sensors\n");
+        return -EINVAL;
+    }
+
+    sim = kzalloc(sizeof(struct maSim), GFP_KERNEL);
+    if (!sim)
+        return -ENOMEM;
+
+    sim->nb = my_sim_sensors;
+
+    for (i = 0; i < sim->nb; i++) {
+        d = &sim->sensors[i];
+
+        // family 0x28, serial number from the bus and the index, CRC
+        rom[0] = 0x28;
+        rom[1] = i + 1;
+        rom[2] = (i + 1) * 37;
+        rom[3] = bus->id;
+        rom[4] = 0x5A;
+        rom[5] = 0x00;
+        rom[6] = 0x00;
+        rom[7] = crc8(rom, 7);
+
+        d->rom = 0;
+        for (k = 0; k < 8; k++)
+            d->rom |= (u64)rom[k] << (8 * k);
+
+        // power on : 85 °C, TH 75 °C, TL 70 °C, my_sim_resolution
+        d->millidegrees = 20000 + i * 250;
+        d->scratchpad[0] = 0x50;
+        d->scratchpad[1] = 0x05;
+        d->scratchpad[2] = 0x4B;
+        d->scratchpad[3] = 0x46;
+        d->scratchpad[4] = ((clamp(my_sim_resolution, 9, 12) - 9) << 5) | 0x1F;
+        d->scratchpad[5] = 0xFF;
+        d->scratchpad[6] = 0x0C;
+        d->scratchpad[7] = 0x10;
+        d->scratchpad[8] = crc8(d->scratchpad, 8);
+        memcpy(d->eeprom, &d->scratchpad[2], 3);
+    }
+
+    bus->sim = sim;
+
+    printk(KERN_INFO "mydevice : bus %i, simulated bus, %i sensors\n", bus->id, sim->nb);
+
+    return 0;
+}
+
+static void simRelease(struct maBus *bus) {
+    kfree(bus->sim);
+    bus->sim = NULL;
+}
+
+static int simReset(struct maBus *bus) {
+    struct maSim *sim = bus->sim;
+    int i;
+
+    sim->state = SIM_ROM_CMD;
+    sim->bits = 0;
+    sim->byte = 0;
+    sim->pos = 0;
+
+    for (i = 0; i < sim->nb; i++)
+        sim->sensors[i].selected = false;
+
+    // presence pulse of the sensors
+    return sim->nb > 0 ? 0 : -ENXIO;
+}
+
+// Start the conversion of the selected sensors
+static void simConvert(struct maSim *sim) {
+    struct maSimSensor *d;
+    int resolution;
+    s16 raw;
+    int i;
+
+    for (i = 0; i < sim->nb; i++) {
+        d = &sim->sensors[i];
+        if (!d->selected)
+            continue;
+
+        resolution = resolutionFromConfig(d->scratchpad[4]);
+        if (resolution < 0)
+            resolution = 12;
+
+        // slow drift of the temperature
+        d->millidegrees += (int)prandom_u32_max(125) - 62;
+
+        raw = d->millidegrees * 16 / 1000;
+        raw &= ~((1 << (12 - resolution)) - 1);
+
+        d->scratchpad[0] = raw & 0xff;
+        d->scratchpad[1] = (raw >> 8) & 0xff;
+        d->scratchpad[8] = crc8(d->scratchpad, 8);
+
+        // integer part of the temperature against TH and TL
+        d->alarm = (raw >> 4) >= (s8)d->scratchpad[2] || (raw >> 4) <= (s8)d->scratchpad[3];
+
+        // 93.75 ms at 9 bits to 750 ms at 12 bits
+        d->convEnd = ktime_add_us(ktime_get(), 93750 << (resolution - 9));
+    }
+}
+
+// A byte received by the sensors
+static void simByte(struct maSim *sim, u8 byte) {
+    struct maSimSensor *d;
+    int i;
+
+    switch (sim->state) {
+    case SIM_ROM_CMD:
+        if (byte == 0x55) {
+            // Match ROM : the 64 next bits
+            sim->state = SIM_MATCH_ROM;
+            sim->pos = 0;
+            sim->match = 0;
+        } else if (byte == 0xCC) {
+            // Skip ROM : every sensor
+            for (i = 0; i < sim->nb; i++)
+                sim->sensors[i].selected = true;
+            sim->state = SIM_FUNC_CMD;
+        } else if (byte == 0xF0) {
+            // Search ROM : every sensor takes part
+            for (i = 0; i < sim->nb; i++)
+                sim->sensors[i].selected = true;
+            sim->state = SIM_SEARCH;
+            sim->pos = 0;
+            sim->step = 0;
+        } else if (byte == 0xEC) {
+            // Alarm Search : the sensors with the alarm flag take part
+            for (i = 0; i < sim->nb; i++)
+                sim->sensors[i].selected = sim->sensors[i].alarm;
+            sim->state = SIM_SEARCH;
+            sim->pos = 0;
+            sim->step = 0;
+        } else {
+            sim->state = SIM_IDLE;
+        }
+        break;
+
+    case SIM_FUNC_CMD:
+        sim->pos = 0;
+        if (byte == 0x44) {
+            simConvert(sim);
+            sim->state = SIM_CONVERT;
+        } else if (byte == 0xBE) {
+            sim->state = SIM_READ_SCRATCHPAD;
+        } else if (byte == 0x4E) {
+            sim->state = SIM_WRITE_SCRATCHPAD;
+        } else if (byte == 0xB4) {
+            sim->state = SIM_POWER;
+        } else {
+            for (i = 0; i < sim->nb; i++) {
+                d = &sim->sensors[i];
+                if (!d->selected)
+                    continue;
+                if (byte == 0x48)
+                    memcpy(d->eeprom, &d->scratchpad[2], 3);
+                else if (byte == 0xB8)
+                    memcpy(&d->scratchpad[2], d->eeprom, 3);
+                d->scratchpad[8] = crc8(d->scratchpad, 8);
+            }
+            sim->state = SIM_IDLE;
+        }
+        break;
+
+    case SIM_WRITE_SCRATCHPAD:
+        // TH, TL, configuration
+        for (i = 0; i < sim->nb; i++) {
+            d = &sim->sensors[i];
+            if (!d->selected)
+                continue;
+            d->scratchpad[2 + sim->pos] = sim->pos == 2 ? (byte & 0x60) | 0x1F : byte;
+            d->scratchpad[8] = crc8(d->scratchpad, 8);
+        }
+        if (++sim->pos == 3)
+            sim->state = SIM_IDLE;
+        break;
+    }
+}
+
+static void simWriteBit(struct maBus *bus, int bit) {
+    struct maSim *sim = bus->sim;
+    struct maSimSensor *d;
+    int i;
+
+    switch (sim->state) {
+    case SIM_MATCH_ROM:
+        sim->match |= (u64)bit << sim->pos;
+        if (++sim->pos == 64) {
+            for (i = 0; i < sim->nb; i++)
+                sim->sensors[i].selected = sim->sensors[i].rom == sim->match;
+            sim->state = SIM_FUNC_CMD;
+            sim->bits = 0;
+            sim->byte = 0;
+        }
+        break;
+
+    case SIM_SEARCH:
+        if (sim->step != 2)
+            break;
+        // the sensors of the other direction leave the search
+        for (i = 0; i < sim->nb; i++) {
+            d = &sim->sensors[i];
+            if (d->selected && ((d->rom >> sim->pos) & 1) != bit)
+                d->selected = false;
+        }
+        sim->step = 0;
+        if (++sim->pos == 64)
+            sim->state = SIM_FUNC_CMD;
+        break;
+
+    case SIM_ROM_CMD:
+    case SIM_FUNC_CMD:
+    case SIM_WRITE_SCRATCHPAD:
+        sim->byte |= bit << sim->bits;
+        if (++sim->bits == 8) {
+            simByte(sim, sim->byte);
+            sim->bits = 0;
+            sim->byte = 0;
+        }
+        break;
+    }
+}
+
+static int simReadBit(struct maBus *bus) {
+    struct maSim *sim = bus->sim;
+    struct maSimSensor *d;
+    int val = 1; // pull-up
+    int i;
+
+    for (i = 0; i < sim->nb; i++) {
+        d = &sim->sensors[i];
+        if (!d->selected)
+            continue;
+
+        // wired AND : a sensor writing 0 pulls the bus low
+        switch (sim->state) {
+        case SIM_CONVERT:
+            if (ktime_before(ktime_get(), d->convEnd))
+                val = 0;
+            break;
+        case SIM_READ_SCRATCHPAD:
+            if (sim->pos < 72 && !((d->scratchpad[sim->pos / 8] >> (sim->pos % 8)) & 1))
+                val = 0;
+            break;
+        case SIM_SEARCH:
+            if (sim->step < 2 && ((d->rom >> sim->pos) & 1) == sim->step)
+                val = 0;
+            break;
+        }
+    }
+
+    if (sim->state == SIM_READ_SCRATCHPAD)
+        sim->pos++;
+    else if (sim->state == SIM_SEARCH && sim->step < 2)
+        sim->step++;
+
+    // noise on the bus
+    if (my_sim_error > 0 && prandom_u32_max(1000000) < my_sim_error) {
+        sim->errors++;
+        val = !val;
+    }
+
+    return val;
+}
+
+static const struct maBusOps simOps = {
+    .name = "sim",
+    .init = simInit,
+    .release = simRelease,
+    .reset = simReset,
+    .writeBit = simWriteBit,
+    .readBit = simReadBit,
+};
+
+// One enumeration of the DS18B20 (Search ROM 0xF0 or Alarm Search 0xEC), iterative with the last discrepancy
+// Each pass follows the ROM found before up to its last discrepancy, then takes the branch 1 there.
+// A pass with an error (no device "11" or bad CRC) is repeated with the same start,
+// the ROMs already found are kept, at most max ROMs in roms.
+// @return number of device, or an error when the enumeration is not complete
+static int searchTree(struct maBus *bus, u8 command, u64 *roms, int max) {
+    int i; // For loop
+    int r; // result of triplet : bit, complement, direction
+    int direction;
+    int lastDiscrepancy = 64; // first pass : the family code, then the branch 0 everywhere
+    int discrepancy; // last branch 0 taken at a conflict in this pass, -1 if none
+    int known = 8; // bits of the path known before the pass
+    int lastErr = -1; // bit of the last bad response
+    int nb = 0;
+    u8 family = 0x28; // number of family at DS18B20
+    u64 rom; // rom of the device found
+    u64 last; // rom of the last pass ok
+    u8 id[8]; // rom as bytes, for the CRC
+    bool ok;
+    int err;
+
+    pr_debug("mydevice : search device (DS18B20), 0x%x\n", command);
+
+    // DS18B20, 0x28 called
+    last = family;
+    bus->errSearch = 0;
+
+    while (true) {
+
+        rom = last;
+        discrepancy = -1;
+
+        if ((err = reset(bus))) {
+            // no presence pulse at the first pass : empty bus
+            if (err == -ENXIO && nb == 0 && lastDiscrepancy == 64)
+                break;
+            return err;
+        }
+        send(bus, command);
+
+        for (i = 0; i < 64; i++) {
+            if (i < lastDiscrepancy)
+                direction = (rom >> i) & 1;
+            else
+                direction = (i == lastDiscrepancy);
+
+            r = triplet(bus, direction);
+
+            // bus held low
+            if (bus->fault)
+                return bus->fault;
+
+            // no device (11)
+            if ((r & 3) == 3)
+                break;
+
+            // the family code and the path up to the last discrepancy are known :
+            // the same branch, then a conflict (00) at the last discrepancy, else a read error
+            if (i < known && ((r >> 2) & 1) != direction)
+                break;
+            if (i == lastDiscrepancy && (r & 3))
+                break;
+
+            // conflict (00), branch 0 taken : next pass takes the branch 1
+            if ((r & 3) == 0 && !(r & 4))
+                discrepancy = i;
+
+            if (r & 4)
+                rom |= (u64)1 << i;
+            else
+                rom &= ~((u64)1 << i);
+        }
+
+        ok = false;
+
+        // no device takes part (no sensor in alarm)
+        if (i == 0 && (r & 3) == 3 && nb == 0 && lastDiscrepancy == 64)
+            break;
+
+        if (i < 64) {
+            printk(KERN_ERR "mydevice : device %i, bad response (%i) : %i\n", nb, r & 3, i);
+
+            // only the branch 0 at the last discrepancy twice : its conflict was a read error,
+            // go on with the discrepancy before it
+            if (i == lastDiscrepancy && (r & 3) == 2 && bus->errSearch > 0 && lastErr == i) {
+                printk(KERN_INFO "mydevice : no branch 1 at %i\n", i);
+                bus->errSearch = 0;
+                lastErr = -1;
+                if (discrepancy < 0)
+                    break;
+                lastDiscrepancy = discrepancy;
+                known = discrepancy;
+                continue;
+            }
+            lastErr = (r & 3) == 2 ? i : -1;
+        } else {
+            for (i = 0; i < 8; i++)
+                id[i] = rom >> (8 * i);
+
+            ok = crc8(id, 7) == id[7];
+            if (!ok)
+                printk(KERN_ERR "mydevice : device %i, CRC KO\n", nb);
+        }
+
+        if (!ok) {
+            if (++bus->errSearch >= MAX_REPEAT_ERR) {
+                printk(KERN_INFO "mydevice : cannot search rom\n");
+                return -EIO;
+            }
+
+            // repeat this branch only
+            bus->stats.searchRestarts++;
+            printk(KERN_INFO "mydevice : restart search rom at device %i\n", nb);
+            continue;
+        }
+
+        bus->errSearch = 0;
+        lastErr = -1;
+
+        // end of the devices of the family
+        if (id[0] != family)
+            break;
+
+        pr_debug("mydevice : device %i, CRC OK\n", nb);
+
+        if (nb == max)
+            break;
+        roms[nb++] = rom;
+
+        if (discrepancy < 0)
+            break;
+
+        last = rom;
+        lastDiscrepancy = discrepancy;
+        known = discrepancy;
+    }
+
+    return nb;
+}
+
+// Search ROM (0xF0) or Alarm Search (0xEC) : a conflict misread as one branch hides the other one
+// without error, so the enumeration is repeated until two of them find the same ROMs
+// found() is called for each ROM, the search stops if it fails.
+// @return number of device, -EIO when the enumerations keep disagreeing, or the error of an enumeration
+static int searchRom(struct maBus *bus, u8 command, int (*found)(struct maBus *bus, u64 rom)) {
+    u64 *roms; // ROMs of each enumeration, MAX_DEVICE each
+    int nb[MAX_REPEAT_ERR];
+    int pass, i;
+    int match = -1; // enumeration confirmed by an other one
+    int err = 0;
+
+    roms = kmalloc_array(MAX_REPEAT_ERR * MAX_DEVICE, sizeof(u64), GFP_KERNEL);
+    if (!roms)
+        return -ENOMEM;
+
+    for (pass = 0; pass < MAX_REPEAT_ERR && match < 0; pass++) {
+        nb[pass] = searchTree(bus, command, roms + pass * MAX_DEVICE, MAX_DEVICE);
+        if (nb[pass] < 0) {
+            err = nb[pass];
+            goto out;
+        }
+
+        for (i = 0; i < pass && match < 0; i++) {
+            if (nb[i] == nb[pass] && !memcmp(roms + i * MAX_DEVICE, roms + pass * MAX_DEVICE, nb[pass] * sizeof(u64)))
+                match = pass;
+        }
+
+        if (match < 0 && pass > 0) {
+            printk(KERN_INFO "mydevice : bus %i, search found %i then %i devices, search again\n", bus->id, nb[pass - 1], nb[pass]);
+            bus->stats.searchRestarts++;
+        }
+    }
+
+    if (match < 0) {
+        printk(KERN_ERR "mydevice : bus %i, search not stable\n", bus->id);
+        err = -EIO;
+        goto out;
+    }
+
+    for (i = 0; i < nb[match]; i++) {
+        if ((err = found(bus, roms[match * MAX_DEVICE + i])))
+            goto out;
+    }
+    err = nb[match];
+
+out:
+    kfree(roms);
+    return err;
+}
+
+// New sensor found by the search, at the end of the list of the bus
+static int addSensor(struct maBus *bus, u64 rom) {
+    if (!plugSensor(bus, rom)) {
+        printk(KERN_ERR "mydevice : no memory\n");
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+// Search all device (DS18B20)
+// @return number of device
+static int search(struct maBus *bus) {
+    return searchRom(bus, 0xF0, addSensor);
+}
+
+// Sensor found by the Alarm Search
+static int alarmSensor(struct maBus *bus, u64 rom) {
+    struct maStructure *s;
+
+    list_for_each_entry(s, &bus->maListe.liste, liste) {
+        if (s->device == rom) {
+            s->alarm = true;
+            return 0;
+        }
+    }
+
+    printk(KERN_INFO "mydevice : bus %i, unknown device in alarm\n", bus->id);
+    return 0;
+}
+
+// Mark the sensors in alarm after a conversion (Alarm Search 0xEC)
+// @return number of sensors in alarm
+static int alarmSearch(struct maBus *bus) {
+    struct maStructure *s;
+
+    list_for_each_entry(s, &bus->maListe.liste, liste)
+        s->alarm = false;
+
+    return searchRom(bus, 0xEC, alarmSensor);
+}
+
+// Sensor found by a rescan : known, or new
+static int rescanSensor(struct maBus *bus, u64 rom) {
+    struct maStructure *s;
+
+    list_for_each_entry(s, &bus->maListe.liste, liste) {
+        if (s->device == rom) {
+            s->seen = true;
+            return 0;
+        }
+    }
+
+    s = plugSensor(bus, rom);
+    if (!s)
+        return -ENOMEM;
+
+    s->seen = true;
+    printk(KERN_INFO "mydevice : bus %i, new device %i\n", bus->id, s->minor);
+
+    if (readConfig(s))
+        printk(KERN_ERR "mydevice : device %i, cannot read configuration\n", s->minor);
+
+    return 0;
+}
+
+// Sensor still answering (scratchpad with a good CRC)
+static bool present(struct maBus *bus, u64 rom) {
+    u8 scratchpad[9];
+
+    if (reset(bus))
+        return false;
+    selectRom(bus, rom);
+    send(bus, 0xBE);
+    readBytes(bus, scratchpad, 9);
+
+    return !bus->fault && crc8(scratchpad, 8) == scratchpad[8];
+}
+
+// Search the bus again : a node for each new sensor, the sensors missing are removed
+// The other sensors are not touched (same minor, same node, open files kept).
+// Nothing is removed when the search is not complete, or when the sensor still answers.
+// @return number of device of the bus
+static int rescanBus(struct maBus *bus) {
+    struct maStructure *s, *next;
+    int before;
+    int removed = 0;
+    int err;
+
+    pr_debug("mydevice : bus %i, rescan\n", bus->id);
+
+    lockBus(bus);
+
+    before = bus->nbDevice;
+    list_for_each_entry(s, &bus->maListe.liste, liste)
+        s->seen = false;
+
+    err = searchRom(bus, 0xF0, rescanSensor);
+
+    if (err >= 0) {
+        list_for_each_entry_safe(s, next, &bus->maListe.liste, liste) {
+            if (!s->seen && !present(bus, s->device)) {
+                unplugSensor(s);
+                removed++;
+            }
+        }
+    }
+
+    // a sensor added or removed : its power changes the one of the bus (polling of the conversions)
+    if (removed || bus->nbDevice != before) {
+        bus->externalPower = readPowerSupply(bus);
+        printk(KERN_INFO "mydevice : bus %i, power : %s\n", bus->id, bus->externalPower ? "external" : "parasite");
+    }
+
+    err = err < 0 ? err : bus->nbDevice;
+
+    unlockBus(bus);
+
+    return err;
+}
+
+// echo 1 > /sys/class/myDevice/bus<N>/rescan
+static ssize_t rescan_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count) {
+    struct maBus *bus = dev_get_drvdata(d);
+    int err;
+
+    err = rescanBus(bus);
+    if (err < 0)
+        return err;
+
+    return count;
+}
+static DEVICE_ATTR_WO(rescan);
+
+// Value of a field of the retry policy, written from user space
+static ssize_t retryStore(int *field, int max, const char *buf, size_t count) {
+    int value;
+    int err;
+
+    if ((err = kstrtoint(buf, 10, &value)))
+        return err;
+
+    if (value < 0 || value > max)
+        return -EINVAL;
+
+    *field = value;
+
+    return count;
+}
+
+// /sys/class/myDevice/bus<N>/retries, backoff_us, reconverts : retry policy of the bus
+static ssize_t retries_show(struct device *d, struct device_attribute *attr, char *buf) {
+    struct maBus *bus = dev_get_drvdata(d);
+
+    return sprintf(buf, "%i\n", bus->retry.retries);
+}
+
+static ssize_t retries_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count) {
+    struct maBus *bus = dev_get_drvdata(d);
+
+    return retryStore(&bus->retry.retries, MAX_RETRIES, buf, count);
+}
+static DEVICE_ATTR_RW(retries);
+
+static ssize_t backoff_us_show(struct device *d, struct device_attribute *attr, char *buf) {
+    struct maBus *bus = dev_get_drvdata(d);
+
+    return sprintf(buf, "%i\n", bus->retry.backoff);
+}
+
+static ssize_t backoff_us_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count) {
+    struct maBus *bus = dev_get_drvdata(d);
+
+    return retryStore(&bus->retry.backoff, MAX_BACKOFF, buf, count);
+}
+static DEVICE_ATTR_RW(backoff_us);
+
+static ssize_t reconverts_show(struct device *d, struct device_attribute *attr, char *buf) {
+    struct maBus *bus = dev_get_drvdata(d);
+
+    return sprintf(buf, "%i\n", bus->retry.reconverts);
+}
+
+static ssize_t reconverts_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count) {
+    struct maBus *bus = dev_get_drvdata(d);
+
+    return retryStore(&bus->retry.reconverts, MAX_RECONVERTS, buf, count);
+}
+static DEVICE_ATTR_RW(reconverts);
+
+static struct attribute *bus_attrs[] = {
+    &dev_attr_rescan.attr,
+    &dev_attr_retries.attr,
+    &dev_attr_backoff_us.attr,
+    &dev_attr_reconverts.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(bus);
+
+// Time (ns) of each kind of 1-Wire transaction on a bus, with its first sensor
+static void benchBus(struct maBus *bus) {
+    struct maStructure *s;
+    u8 scratchpad[9];
+    ktime_t start;
+    s64 tReset, tMatch, tScratchpad;
+    int i, err = 0;
+
+    if (list_empty(&bus->maListe.liste)) {
+        printk(KERN_INFO "mydevice : bench bus %i : no device, search %lld us\n", bus->id, ktime_to_us(bus->searchTime));
+        return;
+    }
+    s = list_first_entry(&bus->maListe.liste, struct maStructure, liste);
+
+    lockBus(bus);
+
+    start = ktime_get();
+    for (i = 0; i < BENCH_LOOPS; i++)
+        reset(bus);
+    tReset = div_s64(ktime_to_ns(ktime_sub(ktime_get(), start)), BENCH_LOOPS);
+
+    start = ktime_get();
+    for (i = 0; i < BENCH_LOOPS; i++) {
+        reset(bus);
+        selectRom(bus, s->device);
+    }
+    tMatch = div_s64(ktime_to_ns(ktime_sub(ktime_get(), start)), BENCH_LOOPS);
+
+    start = ktime_get();
+    for (i = 0; i < BENCH_LOOPS; i++) {
+        if (readScratchpad(s, scratchpad))
+            err++;
+    }
+    tScratchpad = div_s64(ktime_to_ns(ktime_sub(ktime_get(), start)), BENCH_LOOPS);
+
+    unlockBus(bus);
+
+    printk(KERN_INFO "mydevice : bench bus %i : reset %lld ns, match rom %lld ns, read scratchpad %lld ns (%i errors), search %lld us (%i devices)\n",
+        bus->id, tReset, tMatch, tScratchpad, err, ktime_to_us(bus->searchTime), bus->nbDevice);
+}
+
+// Put the autorisations
+static char *mydevnode(struct device *dev, umode_t *mode)
+{
+    if (mode)
+        *mode = 0666; 
+    return NULL;
+}
+
+
+
+// Init the char device
+int gpio_init(void)
+{
+    int i = 0;
+    int err;
+    ktime_t start;
+    const struct maBusOps *ops;
+    struct maBus *bus;
+    struct maStructure *s;
+    char name[16];
+
+    nbDevice = 0;
+
+    printk(KERN_INFO "mydevice : >>> GPIO INIT called\n");
+
+    if (my_buffer < 1) {
+        printk(KERN_ERR "mydevice : invalid my_buffer\n");
+        return -EINVAL;
+    }
+
+    if (my_retries < 0 || my_retries > MAX_RETRIES || my_backoff < 0 || my_backoff > MAX_BACKOFF
+        || my_reconverts < 0 || my_reconverts > MAX_RECONVERTS) {
+        printk(KERN_ERR "mydevice : invalid retry policy\n");
+        return -EINVAL;
+    }
+
+    // the periodic rescan is done by the sampler
+    if (my_rescan > 0 && my_interval <= 0) {
+        printk(KERN_ERR "mydevice : my_rescan needs my_interval\n");
+        return -EINVAL;
+    }
+
+    // Backend
+    if (!strcmp(my_backend, "gpio"))
+        ops = &gpioOps;
+    else if (!strcmp(my_backend, "sim"))
+        ops = &simOps;
+    else {
+        printk(KERN_ERR "mydevice : invalid my_backend\n");
+        return -EINVAL;
+    }
+
+    // Initialisation of each bus
+    for (i = 0; i < nbBus; i++) {
+        bus = &buses[i];
+        bus->id = i;
+        bus->gpio = my_gpio[i];
+        INIT_LIST_HEAD(&bus->maListe.liste);
+        mutex_init(&bus->lock);
+
+        bus->ops = ops;
+        bus->retry.retries = my_retries;
+        bus->retry.backoff = my_backoff;
+        bus->retry.reconverts = my_reconverts;
+
+        printk(KERN_INFO "mydevice : bus %i, %s, my_gpio : %i\n", i, ops->name, bus->gpio);
+
+        if ((err = ops->init(bus))) {
+            freeBuses(i);
+            return err;
+        }
+
+        start = ktime_get();
+        search(bus);
+        bus->searchTime = ktime_sub(ktime_get(), start);
+
+        printk(KERN_INFO "mydevice : >>> bus %i, nb device : %i \n", i, bus->nbDevice);
+
+        bus->externalPower = readPowerSupply(bus);
+        printk(KERN_INFO "mydevice : bus %i, power : %s\n", i, bus->externalPower ? "external" : "parasite");
+
+        // minors are numbered across the buses (plugSensor)
+        list_for_each_entry(s, &bus->maListe.liste, liste) {
+            // TH, TL and resolution, kept when one of them is changed
+            if (readConfig(s))
+                printk(KERN_ERR "mydevice : device %i, cannot read configuration\n", s->minor);
+        }
+    }
+
+    // with my_rescan, the sensors can be plugged later
+    if (nbDevice == 0 && my_rescan <= 0) {
+        printk(KERN_ALERT "mydevice : any device\n");
+        freeBuses(nbBus);
+        return -ENODEV;
+    }
+        
+
+    printk(KERN_INFO "mydevice : >>> nb device : %i \n", nbDevice);
+
+    if (shmInit()) {
+        printk(KERN_ERR "mydevice : no memory for mmap\n");
+        freeBuses(nbBus);
+        return -ENOMEM;
+    }
+
+
+	// Dynamic allocation for (major,minor), every minor (sensors and /dev/myDevice/all)
+	if (alloc_chrdev_region(&dev,0,MAX_DEVICE + 1,"device_DS18B20_0") == -1)
+	{
+		printk(KERN_ALERT "mydevice : >>> ERROR alloc_chrdev_region\n");
+		return -EINVAL;
+	}
+	// Print out the values
+	//printk(KERN_INFO "mydevice : init allocated (major, minor)=(%d,%d)\n",MAJOR(dev),0);
+
+	// Structures allocation
+	my_cdev = cdev_alloc();
+	my_cdev->ops = &fops;
+	my_cdev->owner = THIS_MODULE;
+	// linking operations to device
+	cdev_add(my_cdev,dev,MAX_DEVICE + 1);
+
+    /* Create peripheral class */
+    myClass = class_create(THIS_MODULE, "myDevice");
+    myClass->devnode = mydevnode;
+
+    for (i=0;i<MAX_DEVICE;i++) {
+        if (!minors[i])
+            continue;
+        device_create(myClass, NULL, MKDEV(MAJOR(dev), i), NULL, "/myDevice/device_DS18B20_%i", i);
+        printk(KERN_INFO "mydevice : device %i in /dev/myDevice/device_DS18B20_%i\n", i, i);
+    }
+
+    // every sensor in one read
+    device_create(myClass, NULL, MKDEV(MAJOR(dev), ALL_MINOR), NULL, "/myDevice/all");
+
+    // /sys/kernel/debug/ds18b20 : stats
+    debugDir = debugfs_create_dir("ds18b20", NULL);
+    for (i = 0; i < MAX_DEVICE; i++) {
+        if (minors[i])
+            debugSensor(minors[i]);
+    }
+
+    // /sys/class/myDevice/bus<N> : rescan and retry policy
+    for (i = 0; i < nbBus; i++) {
+        buses[i].dev = device_create_with_groups(myClass, NULL, 0, &buses[i], bus_groups, "bus%i", i);
+        if (IS_ERR(buses[i].dev)) {
+            printk(KERN_ERR "mydevice : bus %i, error sysfs\n", i);
+            buses[i].dev = NULL;
+        }
+
+        snprintf(name, sizeof(name), "bus%i", i);
+        debugfs_create_file(name, 0444, debugDir, &buses[i], &busStats_fops);
+    }
+    
+
+    for (i = 0; i < nbBus && my_bench; i++)
+        benchBus(&buses[i]);
+
+    // Background sampling, one thread for each bus : the buses are swept in parallel
+    for (i = 0; i < nbBus && my_interval > 0; i++) {
+        bus = &buses[i];
+        if (bus->nbDevice == 0 && my_rescan <= 0)
+            continue;
+
+        bus->sampler = kthread_run(samplerThread, bus, "ds18b20_bus%i", i);
+        if (IS_ERR(bus->sampler)) {
+            printk(KERN_ERR "mydevice : bus %i, error sampler thread\n", i);
+            bus->sampler = NULL;
+        }
+    }
+
+    printk(KERN_INFO "mydevice : >>> end GPIO EXIT called\n");
+
+	return(0);
 
 
 }
@@ -963,23 +3012,34 @@ static void gpio_cleanup(void)
 
     printk(KERN_INFO "mydevice : >>> GPIO EXIT called\n");
 
-    // free list
-    list_for_each_safe(pos, q, &maListe.liste){
-        tmpListe = list_entry(pos, struct maStructure, liste);
-        list_del(pos);
-        kfree(tmpListe);
+    // no more rescan
+    for (i = 0; i < nbBus; i++) {
+        if (buses[i].dev)
+            device_unregister(buses[i].dev);
     }
 
-    //gpio_unexport(my_gpio);
-    gpio_free(my_gpio);
+    // stop the background sampling before the bus
+    for (i = 0; i < nbBus; i++) {
+        if (buses[i].sampler)
+            kthread_stop(buses[i].sampler);
+    }
 
-	// Unregister
-	unregister_chrdev_region(dev,nbDevice);
+    vfree(shm);
 
     // node deleted
-    for (i = 0; i < nbDevice; i++) {
-        device_destroy(myClass, MKDEV(MAJOR(dev), i));
+    for (i = 0; i < MAX_DEVICE; i++) {
+        if (minors[i])
+            device_destroy(myClass, MKDEV(MAJOR(dev), i));
     }
+    device_destroy(myClass, MKDEV(MAJOR(dev), ALL_MINOR));
+
+    // free lists and gpio
+    freeBuses(nbBus);
+
+    debugfs_remove_recursive(debugDir);
+
+	// Unregister
+	unregister_chrdev_region(dev,MAX_DEVICE + 1);
 
     // class deleted
     class_destroy(myClass);
@@ -0,0 +1,88 @@
+/*
+ * Interface of the DS18B20 driver shared with user space
+ * (binary sample read from /dev/myDevice/device_DS18B20_<MINOR>, ioctl and batches of /dev/myDevice/all)
+ */
+
+#ifndef DS18B20_H
+#define DS18B20_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Format of read()
+#define DS18B20_FORMAT_TEXT   0 // one line "21.062\n", then end of file
+#define DS18B20_FORMAT_BINARY 1 // one struct ds18b20_sample per read
+#define DS18B20_FORMAT_STREAM 2 // the struct ds18b20_sample kept since the file offset
+
+// Binary sample (fixed size : 32 bytes)
+struct ds18b20_sample {
+    __s64 timestamp;    // CLOCK_MONOTONIC of the read (ns)
+    __u32 seq;          // number of the sample for this sensor
+    __s32 millidegrees; // temperature (m°C)
+    __u8 scratchpad[9]; // raw scratchpad, byte 8 is the CRC
+    __u8 resolution;    // 9 to 12 bits
+    __u8 pad[6];
+};
+
+// Shared memory (read only mmap of any device node, offset 0)
+// A header, then one slot per minor (slot n = minor n) with its last sample, rom 0 : no sensor.
+// A slot is read with its seqcount :
+//     do {
+//         seq = slot->seq;            (odd : the driver is writing the slot)
+//         read barrier
+//         sample = slot->sample;
+//         read barrier
+//     } while ((seq & 1) || seq != slot->seq);
+#define DS18B20_SHM_MAGIC 0x18b20001
+
+struct ds18b20_shm_slot {
+    __u32 seq;     // seqcount
+    __u32 minor;
+    __u64 rom;
+    struct ds18b20_sample sample;
+};
+
+struct ds18b20_shm {
+    __u32 magic;
+    __u32 count; // number of slots
+    __u32 slot_size;
+    __u32 pad;
+    struct ds18b20_shm_slot slots[];
+};
+
+// Alarm thresholds (°C, -55 to 125) of a sensor, TH and TL of its scratchpad
+// The sensor is in alarm when its temperature is >= high or <= low (Alarm Search 0xEC)
+struct ds18b20_alarm {
+    __s32 high; // TH
+    __s32 low;  // TL
+};
+
+// Sensor of a batch (ioctl of /dev/myDevice/all)
+struct ds18b20_entry {
+    __u64 rom;    // in : ROM of the sensor, 0 : the sensor is given by its minor
+    __u32 minor;  // in (rom 0) and out
+    __s32 status; // out : 0 or -errno (-ENODEV : no such sensor)
+    struct ds18b20_sample sample; // out : DS18B20_IOC_READ_BATCH
+};
+
+// Batch of sensors, one call for all of them
+struct ds18b20_batch {
+    __u32 count;      // entries (1 to 128)
+    __u32 resolution; // DS18B20_IOC_SET_RESOLUTION_BATCH : 9 to 12
+    __u64 entries;    // pointer to struct ds18b20_entry[count]
+};
+
+// ioctl
+#define DS18B20_IOC_MAGIC 'w'
+
+#define DS18B20_IOC_SET_FORMAT _IOW(DS18B20_IOC_MAGIC, 1, int)
+#define DS18B20_IOC_GET_FORMAT _IOR(DS18B20_IOC_MAGIC, 2, int)
+#define DS18B20_IOC_SET_ALARM  _IOW(DS18B20_IOC_MAGIC, 3, struct ds18b20_alarm)
+#define DS18B20_IOC_GET_ALARM  _IOR(DS18B20_IOC_MAGIC, 4, struct ds18b20_alarm)
+
+// /dev/myDevice/all : convert and read the sensors of the batch (one conversion window)
+#define DS18B20_IOC_READ_BATCH           _IOWR(DS18B20_IOC_MAGIC, 5, struct ds18b20_batch)
+// /dev/myDevice/all : write the resolution of the sensors of the batch
+#define DS18B20_IOC_SET_RESOLUTION_BATCH _IOWR(DS18B20_IOC_MAGIC, 6, struct ds18b20_batch)
+
+#endif
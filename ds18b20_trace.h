@@ -0,0 +1,133 @@
+/*
+ * Tracepoints of the DS18B20 driver : the 1-Wire protocol steps
+ * (ftrace : /sys/kernel/tracing/events/ds18b20, no cost when disabled)
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ds18b20
+
+#if !defined(DS18B20_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define DS18B20_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Reset pulse, err : 0 (presence pulse), -ENXIO (no sensor) or -EIO (bus held low)
+TRACE_EVENT(ds18b20_reset,
+    TP_PROTO(int bus, int err),
+    TP_ARGS(bus, err),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(int, err)
+    ),
+    TP_fast_assign(
+        __entry->bus = bus;
+        __entry->err = err;
+    ),
+    TP_printk("bus=%d err=%d", __entry->bus, __entry->err)
+);
+
+// ROM or function command (0x55, 0xCC, 0xF0, 0x44, 0xBE...)
+TRACE_EVENT(ds18b20_command,
+    TP_PROTO(int bus, u8 command),
+    TP_ARGS(bus, command),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(u8, command)
+    ),
+    TP_fast_assign(
+        __entry->bus = bus;
+        __entry->command = command;
+    ),
+    TP_printk("bus=%d command=0x%02x", __entry->bus, __entry->command)
+);
+
+// ROM sent after Match ROM
+TRACE_EVENT(ds18b20_select,
+    TP_PROTO(int bus, u64 rom),
+    TP_ARGS(bus, rom),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(u64, rom)
+    ),
+    TP_fast_assign(
+        __entry->bus = bus;
+        __entry->rom = rom;
+    ),
+    TP_printk("bus=%d rom=%016llx", __entry->bus, __entry->rom)
+);
+
+// Bytes written (data of a function command) or read
+DECLARE_EVENT_CLASS(ds18b20_bytes,
+    TP_PROTO(int bus, const u8 *data, int len),
+    TP_ARGS(bus, data, len),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(int, len)
+        __dynamic_array(u8, data, len)
+    ),
+    TP_fast_assign(
+        __entry->bus = bus;
+        __entry->len = len;
+        memcpy(__get_dynamic_array(data), data, len);
+    ),
+    TP_printk("bus=%d len=%d data=%s", __entry->bus, __entry->len,
+        __print_hex(__get_dynamic_array(data), __entry->len))
+);
+
+DEFINE_EVENT(ds18b20_bytes, ds18b20_write,
+    TP_PROTO(int bus, const u8 *data, int len),
+    TP_ARGS(bus, data, len)
+);
+
+DEFINE_EVENT(ds18b20_bytes, ds18b20_read,
+    TP_PROTO(int bus, const u8 *data, int len),
+    TP_ARGS(bus, data, len)
+);
+
+// CRC of a scratchpad read
+TRACE_EVENT(ds18b20_crc,
+    TP_PROTO(int bus, u64 rom, bool ok),
+    TP_ARGS(bus, rom, ok),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(u64, rom)
+        __field(bool, ok)
+    ),
+    TP_fast_assign(
+        __entry->bus = bus;
+        __entry->rom = rom;
+        __entry->ok = ok;
+    ),
+    TP_printk("bus=%d rom=%016llx %s", __entry->bus, __entry->rom, __entry->ok ? "ok" : "ko")
+);
+
+// Temperature conversion (rom 0 : every sensor of the bus)
+TRACE_EVENT(ds18b20_conversion,
+    TP_PROTO(int bus, u64 rom, int resolution, s64 us, int err),
+    TP_ARGS(bus, rom, resolution, us, err),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(u64, rom)
+        __field(int, resolution)
+        __field(s64, us)
+        __field(int, err)
+    ),
+    TP_fast_assign(
+        __entry->bus = bus;
+        __entry->rom = rom;
+        __entry->resolution = resolution;
+        __entry->us = us;
+        __entry->err = err;
+    ),
+    TP_printk("bus=%d rom=%016llx resolution=%d us=%lld err=%d", __entry->bus, __entry->rom,
+        __entry->resolution, __entry->us, __entry->err)
+);
+
+#endif
+
+// Out of the kernel tree : this header is in the directory of the module (CFLAGS_driver.o in the Makefile)
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ds18b20_trace
+#include <trace/define_trace.h>